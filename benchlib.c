@@ -0,0 +1,70 @@
+// Shared helpers for the benchmark programs; see benchlib.h.
+
+#include "kernel/types.h"
+#include "user/user.h"
+#include "user/benchlib.h"
+
+static char *name = "bench";
+static char *usagestr = "";
+
+// Set the program name for messages and its usage line.
+void
+benchinit(char *n, char *u)
+{
+  name = n;
+  usagestr = u;
+}
+
+// Parse "-flag value" pairs; opts ends with a zero flag.
+// Anything else is a usage error.
+void
+benchargs(int argc, char *argv[], struct benchopt *opts)
+{
+  struct benchopt *o;
+  int i;
+
+  for(i = 1; i < argc; i++){
+    if(argv[i][0] != '-' || argv[i][1] == 0 || argv[i][2] != 0 ||
+       i + 1 >= argc)
+      benchusage();
+    for(o = opts; o->flag && o->flag != argv[i][1]; o++)
+      ;
+    if(o->flag == 0)
+      benchusage();
+    i++;
+    if(o->ival)
+      *o->ival = atoi(argv[i]);
+    else
+      o->sfn(argv[i]);
+  }
+}
+
+void
+benchusage(void)
+{
+  fprintf(2, "usage: %s %s\n", name, usagestr);
+  exit(1);
+}
+
+void
+benchdie(char *what)
+{
+  fprintf(2, "%s: %s failed\n", name, what);
+  exit(1);
+}
+
+// n events in ticks, per second
+int
+benchpersec(int n, int ticks)
+{
+  if(ticks == 0)
+    ticks = 1;
+  return n * TICKS_PER_SEC / ticks;
+}
+
+// bytes moved in ticks, in KB per second
+int
+benchkbps(int bytes, int ticks)
+{
+  return benchpersec(bytes / 1024, ticks);
+}
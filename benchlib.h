@@ -0,0 +1,28 @@
+// Shared helpers for the benchmark programs (fsbench, execbench,
+// shmbench, pipebench, uringbench, membench).
+//
+// Every benchmark prints a human-readable summary and, as its last
+// line, a single "BENCH <name> key=value ..." record for scripts
+// (benchrun.py) to parse.  Throughput keys end in _per_sec or kbps,
+// time keys in ticks or _usec, so benchrun knows which way is better.
+//
+// benchlib.o is linked into the benchmark programs only, not into
+// ULIB, and its names all start with "bench" so they cannot clash
+// with a program's own die() or usage().
+
+#define TICKS_PER_SEC 10     // timer interrupt every ~1/10th second in qemu
+
+// One command-line option, "-flag value": an integer stored in
+// *ival, or a string handed to sfn.
+struct benchopt {
+  char flag;
+  int *ival;
+  void (*sfn)(char*);
+};
+
+void benchinit(char *name, char *usage);
+void benchargs(int argc, char *argv[], struct benchopt *opts);
+void benchusage(void) __attribute__((noreturn));
+void benchdie(char *what) __attribute__((noreturn));
+int benchpersec(int n, int ticks);
+int benchkbps(int bytes, int ticks);
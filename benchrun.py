@@ -0,0 +1,242 @@
+#!/usr/bin/env python3
+#
+# Host-side benchmark runner.
+#
+# Builds xv6 once per point of a compile-time parameter matrix, boots
+# each kernel headless under qemu, runs the in-guest benchmarks, and
+# collects their "BENCH <name> key=value ..." lines.  Results can be
+# saved as a baseline and later runs compared against it; a metric is
+# flagged only when it moves the wrong way by more than both a relative
+# threshold and the run-to-run noise measured on either side.
+#
+# usage:
+#   benchrun.py -m NCPU=4,8 -m NBUCKET=13,31 -c 'fsbench -p 4' \
+#               -r 3 --save base.json
+#   benchrun.py -m NCPU=4,8 -m NBUCKET=13,31 -c 'fsbench -p 4' \
+#               -r 3 --baseline base.json
+
+import argparse
+import itertools
+import json
+import os
+import re
+import select
+import shutil
+import signal
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+# where each tunable is #defined in an xv6 tree
+PARAMS = {
+    "NCPU": "kernel/param.h",
+    "NBUF": "kernel/param.h",
+    "NBUCKET": "kernel/bio.c",
+    "BSIZE": "kernel/fs.h",
+    "MAX_THREAD": "user/uthread.c",
+}
+
+# metrics whose direction is known; anything else is reported only.
+# Keep these in step with the BENCH lines the programs print:
+# throughput ends in _per_sec or kbps/mbps, times in ticks or _usec.
+HIGHER_IS_BETTER = re.compile(r"(_per_sec|hits|hit_rate|[km]bps)$")
+LOWER_IS_BETTER = re.compile(
+    r"^(p\d+|ticks|.*_ticks|.*_usec|.*_lat|.*cycles|.*_traps)$")
+
+PROMPT = b"$ "
+BENCH_RE = re.compile(r"^BENCH (\S+) (.*)$")
+
+
+def parse_matrix(specs):
+    axes = []
+    for spec in specs:
+        name, _, values = spec.partition("=")
+        if name not in PARAMS or not values:
+            sys.exit("benchrun: bad matrix entry %r (known: %s)"
+                     % (spec, ", ".join(sorted(PARAMS))))
+        axes.append([(name, v) for v in values.split(",")])
+    return [dict(p) for p in itertools.product(*axes)] or [{}]
+
+
+def config_key(config):
+    return " ".join("%s=%s" % kv for kv in sorted(config.items())) or "default"
+
+
+def patch_tree(tree, config):
+    for name, value in config.items():
+        path = os.path.join(tree, PARAMS[name])
+        with open(path) as f:
+            src = f.read()
+        src, n = re.subn(r"^(#define\s+%s\s+)\S+" % name,
+                         r"\g<1>%s" % value, src, flags=re.M)
+        if n == 0:
+            sys.exit("benchrun: no #define %s in %s" % (name, path))
+        with open(path, "w") as f:
+            f.write(src)
+
+
+def build(src, config):
+    tree = tempfile.mkdtemp(prefix="xv6-bench-")
+    shutil.copytree(src, tree, dirs_exist_ok=True,
+                    ignore=shutil.ignore_patterns(".git", "*.o", "*.d",
+                                                  "fs.img"))
+    patch_tree(tree, config)
+    subprocess.run(["make", "-s", "-C", tree, "clean"], check=True,
+                   stdout=subprocess.DEVNULL)
+    subprocess.run(["make", "-s", "-C", tree, "kernel/kernel", "fs.img"],
+                   check=True, stdout=subprocess.DEVNULL)
+    return tree
+
+
+class Qemu:
+    def __init__(self, tree, cpus, timeout):
+        self.timeout = timeout
+        self.out = b""
+        args = ["make", "-s", "-C", tree, "qemu"]
+        if cpus:
+            args.append("CPUS=%s" % cpus)
+        self.proc = subprocess.Popen(args, stdin=subprocess.PIPE,
+                                     stdout=subprocess.PIPE,
+                                     stderr=subprocess.STDOUT,
+                                     start_new_session=True)
+
+    def wait_for(self, pattern):
+        deadline = time.time() + self.timeout
+        while pattern not in self.out:
+            left = deadline - time.time()
+            if left <= 0:
+                raise TimeoutError("timed out waiting for %r" % pattern)
+            r, _, _ = select.select([self.proc.stdout], [], [], left)
+            if r:
+                data = os.read(self.proc.stdout.fileno(), 4096)
+                if not data:
+                    raise EOFError("qemu exited")
+                self.out += data
+        text, _, self.out = self.out.partition(pattern)
+        return text.decode(errors="replace")
+
+    def run(self, cmd):
+        self.proc.stdin.write(cmd.encode() + b"\n")
+        self.proc.stdin.flush()
+        return self.wait_for(PROMPT)
+
+    def kill(self):
+        try:
+            os.killpg(self.proc.pid, signal.SIGTERM)
+        except ProcessLookupError:
+            pass
+        self.proc.wait()
+
+
+def boot_and_run(tree, config, cmds, timeout):
+    vm = Qemu(tree, config.get("NCPU"), timeout)
+    results = {}
+    try:
+        vm.wait_for(PROMPT)
+        for cmd in cmds:
+            for line in vm.run(cmd).splitlines():
+                m = BENCH_RE.match(line.strip())
+                if not m:
+                    continue
+                metrics = results.setdefault("%s: %s" % (cmd, m.group(1)), {})
+                for kv in m.group(2).split():
+                    k, _, v = kv.partition("=")
+                    try:
+                        metrics[k] = float(v)
+                    except ValueError:
+                        pass
+    finally:
+        vm.kill()
+    return results
+
+
+def summarize(samples):
+    med = statistics.median(samples)
+    mad = statistics.median(abs(s - med) for s in samples)
+    return {"median": med, "mad": mad, "n": len(samples)}
+
+
+def compare(base, cur, rel, k):
+    regressions = 0
+    for config in sorted(cur):
+        for bench in sorted(cur[config]):
+            for metric, now in sorted(cur[config][bench].items()):
+                was = base.get(config, {}).get(bench, {}).get(metric)
+                if was is None:
+                    continue
+                if HIGHER_IS_BETTER.search(metric):
+                    worse = was["median"] - now["median"]
+                elif LOWER_IS_BETTER.search(metric):
+                    worse = now["median"] - was["median"]
+                else:
+                    continue
+                # 1.4826 * MAD estimates the standard deviation
+                noise = k * 1.4826 * max(was["mad"], now["mad"])
+                limit = max(rel * abs(was["median"]), noise)
+                status = "ok"
+                if worse > limit:
+                    status = "REGRESSION"
+                    regressions += 1
+                elif -worse > limit:
+                    status = "improved"
+                print("%-10s %s | %s | %s: %g -> %g (limit %g)"
+                      % (status, config, bench, metric, was["median"],
+                         now["median"], limit))
+    return regressions
+
+
+def main():
+    ap = argparse.ArgumentParser(prog="benchrun")
+    ap.add_argument("-C", "--xv6", default=".", help="xv6 source tree")
+    ap.add_argument("-m", "--matrix", action="append", default=[],
+                    help="NAME=v1,v2,... (repeatable)")
+    ap.add_argument("-c", "--cmd", action="append", default=[],
+                    help="in-guest benchmark command (repeatable)")
+    ap.add_argument("-r", "--runs", type=int, default=3,
+                    help="boots per configuration")
+    ap.add_argument("-t", "--timeout", type=int, default=300,
+                    help="seconds to wait for each command")
+    ap.add_argument("--save", help="write results as a baseline file")
+    ap.add_argument("--baseline", help="compare against a baseline file")
+    ap.add_argument("--rel", type=float, default=0.05,
+                    help="relative change tolerated (default 0.05)")
+    ap.add_argument("--noise", type=float, default=3.0,
+                    help="noise multiplier on the MAD (default 3)")
+    args = ap.parse_args()
+    if not args.cmd:
+        args.cmd = ["fsbench"]
+
+    results = {}
+    for config in parse_matrix(args.matrix):
+        key = config_key(config)
+        tree = build(args.xv6, config)
+        samples = {}
+        try:
+            for i in range(args.runs):
+                print("benchrun: %s run %d/%d" % (key, i + 1, args.runs),
+                      file=sys.stderr)
+                for bench, metrics in boot_and_run(tree, config, args.cmd,
+                                                   args.timeout).items():
+                    for metric, v in metrics.items():
+                        samples.setdefault(bench, {}).setdefault(
+                            metric, []).append(v)
+        finally:
+            shutil.rmtree(tree)
+        results[key] = {b: {m: summarize(v) for m, v in ms.items()}
+                        for b, ms in samples.items()}
+
+    print(json.dumps(results, indent=2, sort_keys=True))
+    if args.save:
+        with open(args.save, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+    if args.baseline:
+        with open(args.baseline) as f:
+            base = json.load(f)
+        if compare(base, results, args.rel, args.noise):
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
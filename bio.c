@@ -12,6 +12,8 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * To use a block only if it is cached and free, without
+//     sleeping, call bread_nowait.
 
 
 #include "types.h"
@@ -19,10 +21,16 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
 
+// buffer data is carved out of whole kalloc pages
+#if BSIZE > PGSIZE || PGSIZE % BSIZE != 0
+#error "BSIZE must divide PGSIZE"
+#endif
+
 // number of buckets
 #define NBUCKET 13
 // the length of lock name
@@ -31,6 +39,14 @@
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
+  // statistics, updated with atomic adds
+  uint64 nread;     // blocks read from disk
+  uint64 nwrite;    // blocks written to disk
+  uint64 nnoread;   // misses filled by boverwrite() without a read
+  uint64 nzeroread; // reads that returned an all-zero block
+  uint64 nzeroskip; // writes of zeros over a block known to be zero
+  uint64 nmetahit;  // breadmeta() calls that found the block cached
+  uint64 nmetamiss; // breadmeta() calls that read the disk
 }bcache;
 
 // each bucket has its lock
@@ -41,14 +57,58 @@ struct {
 
 char bucket_lock_name[NBUCKET][LNAME_LEN];
 
+// buffers reserved for file-system metadata blocks
+#define NMETA (NBUF / 2)
+
+// buffers each CPU remembers from its recent brelse calls
+#define NLOOKASIDE 4
+
+// nanoseconds per r_time() unit: qemu virt's timebase is 10 MHz
+#define TIMEBASE_NS 100
+
+// per-CPU lookaside, checked before walking a bucket chain
+struct {
+  struct buf *buf[NLOOKASIDE];
+  int next;   // slot to overwrite next
+  uint64 hits;
+  uint64 misses;
+  // what a bget hit costs, from entry until the block is found,
+  // in r_time() units, so bstats can show what the lookaside saves
+  uint64 hitn;        // bget hits through the lookaside
+  uint64 hittime;
+  uint64 chainhits;   // hits found by walking the bucket chain
+  uint64 chaintime;
+} lookaside[NCPU];
+
+// I/O priority classes, most urgent first.
+#define IOPRIO_SYNC_READ  0   // a process is waiting for the data
+#define IOPRIO_SYNC_WRITE 1
+#define IOPRIO_ASYNC      2   // background writes, nobody waits on them
+#define NIOPRIO           3
+
+// requests the driver can hold at once (NUM descriptors / 3 per request)
+#define NINFLIGHT     2
+// dispatches a waiting class may be passed over before it goes first
+#define IOPRIO_STARVE 8
+
+// admission to the disk driver, by priority class
+struct {
+  struct spinlock lock;
+  int inflight;
+  int nwait[NIOPRIO];
+  int passed[NIOPRIO];
+} iosched;
+
 
 void
 binit(void)
 {
   struct buf *b;
+  uchar *page = 0;
   int i;
   
   initlock(&bcache.lock, "bcache");
+  initlock(&iosched.lock, "iosched");
  
   for(i = 0; i < NBUCKET; i++){
      snprintf(bucket_lock_name[i], LNAME_LEN, "bcache.bucket%d", i);
@@ -65,12 +125,73 @@ binit(void)
      bucket[0].head.next->prev = b;
      bucket[0].head.next = b;
      b->lu_time = -1;
+
+     // PGSIZE/BSIZE buffers share each page
+     if((b - bcache.buf) % (PGSIZE / BSIZE) == 0){
+       if((page = kalloc()) == 0)
+         panic("binit: kalloc");
+     }
+     b->data = page + ((b - bcache.buf) % (PGSIZE / BSIZE)) * BSIZE;
      
      //printf("binit: b->lu_time = %d\n", b->lu_time);
      //printf("binit: b = %d", b);
   }
 }
 
+// Search this CPU's lookaside array for block blockno on dev,
+// without taking a lock, so a miss costs nothing under the bucket
+// lock.  The answer is only a hint: entries are not removed on
+// eviction, and the buffer may be recycled at any moment, so the
+// caller checks it again with lookaside_valid.
+static struct buf*
+lookaside_probe(uint dev, uint blockno)
+{
+  struct buf *b;
+  int i, id;
+
+  push_off();
+  id = cpuid();
+  for(i = 0; i < NLOOKASIDE; i++){
+    b = lookaside[id].buf[i];
+    if(b && b->dev == dev && b->blockno == blockno)
+      break;
+  }
+  pop_off();
+  return i < NLOOKASIDE ? b : 0;
+}
+
+// Is the probed buffer b still block blockno on dev?  Caller holds
+// the block's bucket lock, which pins the identity of any buffer
+// holding this block (see bget), so the answer is now exact.
+// A hit saves the chain walk under the lock, not the lock itself,
+// which also guards refcnt.
+static int
+lookaside_valid(struct buf *b, uint dev, uint blockno)
+{
+  int id = cpuid();
+
+  if(b && b->dev == dev && b->blockno == blockno){
+    lookaside[id].hits++;
+    return 1;
+  }
+  lookaside[id].misses++;
+  return 0;
+}
+
+// Remember b as recently released by this CPU.
+// Caller holds b's bucket lock.
+static void
+lookaside_add(struct buf *b)
+{
+  int i, id = cpuid();
+
+  for(i = 0; i < NLOOKASIDE; i++)
+    if(lookaside[id].buf[i] == b)
+      return;
+  lookaside[id].buf[lookaside[id].next] = b;
+  lookaside[id].next = (lookaside[id].next + 1) % NLOOKASIDE;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
@@ -78,18 +199,31 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  uint64 t0 = r_time();
 
   //printf("bget: argu dev is %d blockno is %d\n", dev, blockno);
 
   int hash_n = blockno % NBUCKET;
 
+  // Recently released by this CPU?
+  b = lookaside_probe(dev, blockno);
   acquire(&bucket[hash_n].lock);
+  if(lookaside_valid(b, dev, blockno)){
+    b->refcnt++;
+    lookaside[cpuid()].hitn++;
+    lookaside[cpuid()].hittime += r_time() - t0;
+    release(&bucket[hash_n].lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
 
   // Is the block already cached?
   for(b = bucket[hash_n].head.next; b != &bucket[hash_n].head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       //printf("bget: cache hit\n");
       b->refcnt++;
+      lookaside[cpuid()].chainhits++;
+      lookaside[cpuid()].chaintime += r_time() - t0;
       release(&bucket[hash_n].lock);
       acquiresleep(&b->lock);
       return b;
@@ -116,22 +250,39 @@ bget(uint dev, uint blockno)
   
   
   // Recycle the least recently used (LRU) unused buffer.
+  // Metadata buffers, up to NMETA of them, are passed over
+  // while an unused data buffer is available.
   struct buf *lru = 0;
+  struct buf *lru_meta;
+  int nmeta;
   
   while(lru == 0){
     //printf("bget: lru = %d\n", lru);
     /* search the buffer whose lu_time is min and
      and refcnt == 0 */
+    lru_meta = 0;
+    nmeta = 0;
     for(b = bcache.buf; b < bcache.buf + NBUF; b++){
       //printf("bget: b = %d\n", b);
       //printf("bget: b->refcnt = %d\n", b->refcnt);
       //printf("bget: b->lu_time = %d\n", b->lu_time);
       //printf("bget: b->blockno = %d\n", b->blockno);
-      if(b->refcnt == 0 && (lru == 0 || b->lu_time < lru->lu_time)){
+      if(b->meta)
+        nmeta++;
+      if(b->refcnt != 0)
+        continue;
+      if(b->meta){
+        if(lru_meta == 0 || b->lu_time < lru_meta->lu_time)
+          lru_meta = b;
+      } else if(lru == 0 || b->lu_time < lru->lu_time){
         lru = b;
         //printf("bget: lru to be b(b->blockno = %d)\n", b->blockno);
       }
     }
+    // over its share, metadata competes with data on age alone
+    if(lru_meta && (lru == 0 ||
+       (nmeta > NMETA && lru_meta->lu_time < lru->lu_time)))
+      lru = lru_meta;
   
     if(lru){
       //printf("bget: in if(lru){...}\n");
@@ -152,13 +303,18 @@ bget(uint dev, uint blockno)
       lru->next->prev = lru->prev;  
       lru->prev->next = lru->next;
 
-      if(lru_hash_n != hash_n){
-	release(&bucket[lru_hash_n].lock);
-      }
+      // change identity before dropping the old bucket's lock,
+      // so a lookaside check holding that lock sees either the
+      // old block in its bucket or a block it is not looking for
       lru->dev = dev;
       lru->blockno = blockno;
       lru->valid = 0;
+      lru->diskzero = 0;
+      lru->meta = 0;
       lru->refcnt = 1;
+      if(lru_hash_n != hash_n){
+	release(&bucket[lru_hash_n].lock);
+      }
       // move lru to the head of bucket[hash_n]' list
       lru->prev = &bucket[hash_n].head;
       lru->next = bucket[hash_n].head.next;
@@ -176,6 +332,74 @@ bget(uint dev, uint blockno)
   panic("bget: no buffers");
 }
 
+// May a request of class prio be dispatched now?
+// Caller holds iosched.lock.
+static int
+iosched_turn(int prio)
+{
+  int p;
+
+  if(iosched.inflight >= NINFLIGHT)
+    return 0;
+  // a starved class goes next, ahead of everyone else
+  for(p = NIOPRIO - 1; p >= 0; p--)
+    if(iosched.nwait[p] > 0 && iosched.passed[p] >= IOPRIO_STARVE)
+      return p == prio;
+  // otherwise strictly by class
+  for(p = 0; p < prio; p++)
+    if(iosched.nwait[p] > 0)
+      return 0;
+  return 1;
+}
+
+// Hand a locked buffer to the disk driver.
+// All buffer cache I/O goes through here, so the choice of
+// which device or queue serves a request is made in one place.
+// Requests wait their turn by b->ioprio so that background
+// writes cannot fill the driver queue ahead of a bread() miss.
+static void
+bdisk_rw(struct buf *b, int write)
+{
+  int p, prio = b->ioprio;
+
+  // memory is not a shared queue; nothing to wait for
+  if(b->dev == RAMDISKDEV){
+    ramdisk_rw(b, write);
+    return;
+  }
+
+  acquire(&iosched.lock);
+  iosched.nwait[prio]++;
+  while(!iosched_turn(prio))
+    sleep(&iosched, &iosched.lock);
+  iosched.nwait[prio]--;
+  for(p = prio + 1; p < NIOPRIO; p++)
+    if(iosched.nwait[p] > 0)
+      iosched.passed[p]++;
+  iosched.passed[prio] = 0;
+  iosched.inflight++;
+  release(&iosched.lock);
+
+  virtio_disk_rw(b, write);
+
+  acquire(&iosched.lock);
+  iosched.inflight--;
+  wakeup(&iosched);
+  release(&iosched.lock);
+}
+
+// Read a locked, invalid buffer's block from disk.
+static void
+bfill(struct buf *b)
+{
+  b->ioprio = IOPRIO_SYNC_READ;
+  bdisk_rw(b, 0);
+  __sync_fetch_and_add(&bcache.nread, 1);
+  b->valid = 1;
+  if((b->diskzero = zerowords(b->data, BSIZE)) != 0)
+    __sync_fetch_and_add(&bcache.nzeroread, 1);
+}
+
 // Return a locked buf with the contents of the indicated block.
 struct buf*
 bread(uint dev, uint blockno)
@@ -184,19 +408,145 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    bfill(b);
+  }
+  return b;
+}
+
+// Like bread, for file-system metadata (log header, inode,
+// bitmap, indirect and directory blocks).  The buffer is
+// tagged so that eviction prefers data blocks over it.
+struct buf*
+breadmeta(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if(b->valid)
+    __sync_fetch_and_add(&bcache.nmetahit, 1);
+  else {
+    __sync_fetch_and_add(&bcache.nmetamiss, 1);
+    bfill(b);
+  }
+  b->meta = 1;
+  return b;
+}
+
+// Take lk if it is free, without sleeping.
+// Returns 1 on success, 0 if another process holds it.
+static int
+tryacquiresleep(struct sleeplock *lk)
+{
+  int ok = 0;
+
+  acquire(&lk->lk);
+  if(!lk->locked){
+    lk->locked = 1;
+    lk->pid = myproc()->pid;
+    ok = 1;
+  }
+  release(&lk->lk);
+  return ok;
+}
+
+// Return the indicated block, locked, only if it is cached,
+// valid and not in use; never sleeps.  Otherwise return 0
+// and set *status to BNOWAIT_MISS (not cached) or
+// BNOWAIT_BUSY (cached but locked or still being read).
+// A miss does not start a read: virtio_disk_rw sleeps its caller
+// until the disk is done, and there is no kernel thread to sleep
+// on the caller's behalf, so a caller that wants the block must
+// bread it itself, or have a process of its own do so.
+struct buf*
+bread_nowait(uint dev, uint blockno, int *status)
+{
+  struct buf *b;
+  int hash_n = blockno % NBUCKET;
+
+  b = lookaside_probe(dev, blockno);
+  acquire(&bucket[hash_n].lock);
+  if(!lookaside_valid(b, dev, blockno)){
+    for(b = bucket[hash_n].head.next; b != &bucket[hash_n].head; b = b->next)
+      if(b->dev == dev && b->blockno == blockno)
+        break;
+    if(b == &bucket[hash_n].head){
+      release(&bucket[hash_n].lock);
+      *status = BNOWAIT_MISS;
+      return 0;
+    }
+  }
+  if(!tryacquiresleep(&b->lock)){
+    release(&bucket[hash_n].lock);
+    *status = BNOWAIT_BUSY;
+    return 0;
+  }
+  if(!b->valid){
+    // recycled by bget, whose caller is about to read it
+    releasesleep(&b->lock);
+    release(&bucket[hash_n].lock);
+    *status = BNOWAIT_BUSY;
+    return 0;
+  }
+  b->refcnt++;
+  release(&bucket[hash_n].lock);
+  return b;
+}
+
+// Return a locked buf for a block the caller is about to
+// overwrite in full, e.g. a freshly allocated block or a
+// whole-block file write.  The old contents are not read
+// from disk, so the caller must fill all BSIZE bytes of
+// b->data before releasing it.
+struct buf*
+boverwrite(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if(!b->valid) {
+    __sync_fetch_and_add(&bcache.nnoread, 1);
     b->valid = 1;
   }
   return b;
 }
 
+// Write b's contents to disk with the given priority.
+// Rewriting zeros over a block already known to be zero
+// on disk (b->diskzero) is skipped.
+static void
+bwrite_prio(struct buf *b, int prio)
+{
+  int zero = zerowords(b->data, BSIZE);
+
+  if(zero && b->diskzero){
+    __sync_fetch_and_add(&bcache.nzeroskip, 1);
+    return;
+  }
+  b->ioprio = prio;
+  bdisk_rw(b, 1);
+  b->diskzero = zero;
+  __sync_fetch_and_add(&bcache.nwrite, 1);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  bwrite_prio(b, IOPRIO_SYNC_WRITE);
+}
+
+// Like bwrite, for writes no process is waiting on
+// (e.g. installing logged blocks to their home location).
+// They yield the disk to synchronous requests, up to
+// IOPRIO_STARVE dispatches at a time.
+void
+bwrite_bg(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_bg");
+  bwrite_prio(b, IOPRIO_ASYNC);
 }
 
 // Release a locked buffer.
@@ -214,6 +564,7 @@ brelse(struct buf *b)
   //acquire(&tickslock);
   b->lu_time = ticks;
   //release(&tickslock);
+  lookaside_add(b);
   //printf("brelse: \n");
   release(&bucket[b->blockno % NBUCKET].lock);
 }
@@ -232,4 +583,83 @@ bunpin(struct buf *b) {
   release(&bucket[b->blockno % NBUCKET].lock);
 }
 
+// Add delta to the refcnt of n buffers, taking each
+// bucket lock once rather than once per buffer.
+static void
+bpin_many(struct buf **bufs, int n, int delta)
+{
+  int h, i, locked;
+
+  for(h = 0; h < NBUCKET; h++){
+    locked = 0;
+    for(i = 0; i < n; i++){
+      if(bufs[i]->blockno % NBUCKET != h)
+        continue;
+      if(!locked){
+        acquire(&bucket[h].lock);
+        locked = 1;
+      }
+      bufs[i]->refcnt += delta;
+    }
+    if(locked)
+      release(&bucket[h].lock);
+  }
+}
+
+void
+bpin_batch(struct buf **bufs, int n) {
+  bpin_many(bufs, n, 1);
+}
+
+void
+bunpin_batch(struct buf **bufs, int n) {
+  bpin_many(bufs, n, -1);
+}
+
+// Write n locked buffers to disk as one burst, e.g. the
+// blocks of a group commit.  The driver takes one request
+// at a time, so they are submitted back to back.
+void
+bwrite_batch(struct buf **bufs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bufs[i]->lock))
+      panic("bwrite_batch");
+    bwrite_prio(bufs[i], IOPRIO_SYNC_WRITE);
+  }
+}
+
+// Print buffer cache statistics to the console.
+void
+bstats(void)
+{
+  uint64 hits, misses, hitn, hittime, chainhits, chaintime;
+  int i;
+
+  printf("bcache: %d bufs of %d bytes, %d header bytes each\n",
+         NBUF, BSIZE, (int)sizeof(struct buf));
+  printf("bcache: %d reads %d writes %d reads skipped\n",
+         (int)bcache.nread, (int)bcache.nwrite, (int)bcache.nnoread);
+  printf("bcache: %d zero blocks read, %d zero writes skipped\n",
+         (int)bcache.nzeroread, (int)bcache.nzeroskip);
+  printf("bcache: metadata %d hits %d misses\n",
+         (int)bcache.nmetahit, (int)bcache.nmetamiss);
 
+  hits = misses = hitn = hittime = chainhits = chaintime = 0;
+  for(i = 0; i < NCPU; i++){
+    hits += lookaside[i].hits;
+    misses += lookaside[i].misses;
+    hitn += lookaside[i].hitn;
+    hittime += lookaside[i].hittime;
+    chainhits += lookaside[i].chainhits;
+    chaintime += lookaside[i].chaintime;
+  }
+  printf("bcache: lookaside %d hits %d misses\n", (int)hits, (int)misses);
+  // mean bget lookup time for a hit each way, lock included
+  printf("bcache: hit lookup ns: lookaside %d, bucket chain %d (%d hits)\n",
+         hitn ? (int)(hittime * TIMEBASE_NS / hitn) : 0,
+         chainhits ? (int)(chaintime * TIMEBASE_NS / chainhits) : 0,
+         (int)chainhits);
+}
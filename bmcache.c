@@ -0,0 +1,98 @@
+// Block-map cache.
+//
+// Remembers recent (inode, file block) -> disk block translations
+// for blocks reached through the indirect block, so bmap can skip
+// the bread of the indirect block (bucket lock, chain walk and
+// sleeplock) on repeated access to the same part of a big file.
+// Direct blocks are in ip->addrs already and are not cached here.
+//
+// The table is direct-mapped and indexed by a hash of
+// (dev, inum, bn), so a new entry simply replaces the old one in
+// its slot.  Entries are exact copies of what the indirect block
+// says, so the cache only has to follow its changes:
+// * bmap calls bmcache_get first, and bmcache_put with each
+//     translation it reads from the indirect block or allocates.
+// * itrunc calls bmcache_inval before freeing the inode's blocks.
+// Inode numbers are reused only after itrunc, so a stale entry
+// cannot outlive the file it describes.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+
+#define NBMCACHE 256
+
+struct bmentry {
+  uint dev;
+  uint inum;    // 0 if the slot is empty
+  uint bn;      // block number within the file
+  uint addr;    // disk block number
+};
+
+struct {
+  struct spinlock lock;
+  struct bmentry e[NBMCACHE];
+  uint hits;
+  uint misses;
+} bmcache;
+
+void
+bmcacheinit(void)
+{
+  initlock(&bmcache.lock, "bmcache");
+}
+
+static struct bmentry*
+slot(uint dev, uint inum, uint bn)
+{
+  return &bmcache.e[(dev * 31 + inum * 131 + bn) % NBMCACHE];
+}
+
+// Return the disk block holding block bn of inode inum,
+// or 0 if the translation is not cached.
+uint
+bmcache_get(uint dev, uint inum, uint bn)
+{
+  struct bmentry *e;
+  uint addr = 0;
+
+  acquire(&bmcache.lock);
+  e = slot(dev, inum, bn);
+  if(e->inum == inum && e->dev == dev && e->bn == bn){
+    addr = e->addr;
+    bmcache.hits++;
+  } else
+    bmcache.misses++;
+  release(&bmcache.lock);
+  return addr;
+}
+
+void
+bmcache_put(uint dev, uint inum, uint bn, uint addr)
+{
+  struct bmentry *e;
+
+  acquire(&bmcache.lock);
+  e = slot(dev, inum, bn);
+  e->dev = dev;
+  e->inum = inum;
+  e->bn = bn;
+  e->addr = addr;
+  release(&bmcache.lock);
+}
+
+// Forget every translation for inode inum.
+void
+bmcache_inval(uint dev, uint inum)
+{
+  struct bmentry *e;
+
+  acquire(&bmcache.lock);
+  for(e = bmcache.e; e < bmcache.e + NBMCACHE; e++)
+    if(e->inum == inum && e->dev == dev)
+      e->inum = 0;
+  release(&bmcache.lock);
+}
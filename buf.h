@@ -1,13 +1,23 @@
+// device number of the RAM-backed block device (ramdisk.c)
+#define RAMDISKDEV 2
+
+// why bread_nowait returned no buffer
+#define BNOWAIT_MISS 1   // block not in the cache
+#define BNOWAIT_BUSY 2   // cached, but locked by another process
+
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int diskzero; // is the block known to be all zeros on disk?
+  int meta;    // file-system metadata? (kept longer on eviction)
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
-  uchar data[BSIZE];
+  uchar *data;      // BSIZE bytes inside a kalloc page
   uint64 lu_time;   // last used time
+  int ioprio;       // priority class of the pending disk request
 };
 
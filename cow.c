@@ -0,0 +1,60 @@
+// Copy-on-write faults.
+//
+// A PTE_COW mapping is read-only because the page may be shared
+// (see ksm.c).  The first write, a store page fault in usertrap or
+// a copyout into the page, calls cowfault, which gives the process
+// a private writable copy.  If the process turns out to hold the
+// only reference, the page is made writable in place instead.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "cow.h"
+
+extern struct spinlock ksmlock;   // see ksm.c
+
+uint64 ncowcopy;    // faults that copied a shared page
+uint64 ncowreuse;   // faults that found the page unshared
+
+// Make the user page at va in pagetable writable, copying it
+// if it is shared.  Returns 0 on success, -1 if va is not a
+// copy-on-write page or no memory is left.
+int
+cowfault(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_COW) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+
+  // ksm.c only adds references to merged pages while holding
+  // ksmlock, so a count of 1 seen here cannot grow under us.
+  acquire(&ksmlock);
+  if(krefcnt((void*)pa) == 1){
+    kmarkmerged((void*)pa, 0);
+    *pte = (*pte | PTE_W) & ~PTE_COW;
+    release(&ksmlock);
+    __sync_fetch_and_add(&ncowreuse, 1);
+    sfence_vma();
+    return 0;
+  }
+  release(&ksmlock);
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | ((PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW);
+  kfree((void*)pa);
+  __sync_fetch_and_add(&ncowcopy, 1);
+  sfence_vma();
+  return 0;
+}
@@ -0,0 +1,14 @@
+// PTE bit (one of the two reserved for software) marking a
+// read-only mapping of a page that is writable in principle:
+// a write must first break the sharing, see cowfault().
+#define PTE_COW (1L << 8)
+
+// PTE bit (the other software one) marking a page that is not in
+// memory: PTE_V is clear and the PPN field holds a swap slot, or a
+// zram slot with ZSLOT set; see swap.c.
+#define PTE_SWAP (1L << 9)
+#define ZSLOT    (1L << 30)   // in the slot number, not the PTE
+
+#ifndef PTE_A
+#define PTE_A (1L << 6)       // set by hardware on access
+#endif
@@ -0,0 +1,104 @@
+// exec latency benchmark.
+//
+// Runs the same binary (this one) many times, first one instance
+// at a time and then nproc instances side by side, to show what
+// sharing text pages between processes (textcache.c) saves.
+// Memory footprint is reported by the kernel's textcachestats.
+//
+// usage: execbench [-n execs] [-p nproc]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "user/benchlib.h"
+
+#define MAXPROC     64
+#define HOLD        10       // ticks each concurrent instance stays alive
+
+int nexec = 100;
+int nproc = 16;
+
+struct benchopt opts[] = {
+  { 'n', &nexec },
+  { 'p', &nproc },
+  { 0 },
+};
+
+// Exec this binary in a child; the child's arguments say what it does.
+int
+spawn(char *mode, int fd)
+{
+  char fdarg[4];
+  char *argv[4];
+  int pid;
+
+  if((pid = fork()) < 0)
+    benchdie("fork");
+  if(pid == 0){
+    fdarg[0] = '0' + fd / 10;
+    fdarg[1] = '0' + fd % 10;
+    fdarg[2] = 0;
+    argv[0] = "execbench";
+    argv[1] = mode;
+    argv[2] = fdarg;
+    argv[3] = 0;
+    exec("execbench", argv);
+    benchdie("exec");
+  }
+  return pid;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, t0, serial, started, fds[2];
+  char c;
+
+  // child modes: -x exits at once, -w reports in and stays a while
+  if(argc == 3 && strcmp(argv[1], "-x") == 0)
+    exit(0);
+  if(argc == 3 && strcmp(argv[1], "-w") == 0){
+    write(atoi(argv[2]), "x", 1);
+    sleep(HOLD);
+    exit(0);
+  }
+
+  benchinit("execbench", "[-n execs] [-p nproc]");
+  benchargs(argc, argv, opts);
+  if(nexec < 1 || nproc < 1 || nproc > MAXPROC)
+    benchusage();
+
+  // one at a time: fork, exec, exit, wait
+  t0 = uptime();
+  for(i = 0; i < nexec; i++){
+    spawn("-x", 0);
+    wait(0);
+  }
+  serial = uptime() - t0;
+
+  // nproc at once: time until every instance is running
+  if(pipe(fds) < 0)
+    benchdie("pipe");
+  t0 = uptime();
+  for(i = 0; i < nproc; i++)
+    spawn("-w", fds[1]);
+  close(fds[1]);
+  for(i = 0; i < nproc && read(fds[0], &c, 1) == 1; i++)
+    ;
+  started = uptime() - t0;
+  close(fds[0]);
+  if(i < nproc)
+    fprintf(2, "execbench: only %d of %d instances started\n", i, nproc);
+  while(wait(0) >= 0)
+    ;
+
+  printf("execbench: %d serial execs in %d ticks, %d usec each\n",
+         nexec, serial, serial * (1000000 / TICKS_PER_SEC) / nexec);
+  printf("execbench: %d concurrent instances running after %d ticks\n",
+         nproc, started);
+  printf("BENCH execbench execs=%d serial_ticks=%d exec_usec=%d "
+         "nproc=%d start_ticks=%d\n",
+         nexec, serial, serial * (1000000 / TICKS_PER_SEC) / nexec,
+         nproc, started);
+  exit(0);
+}
@@ -0,0 +1,128 @@
+// In-memory summary of the on-disk free-block bitmap.
+//
+// Keeps a count of free blocks per bitmap block and a cursor
+// just past the last allocation, so balloc can go straight to
+// a bitmap block with free space and start near where the
+// previous search stopped, instead of testing bits from block 0
+// on every call.
+//
+// The counts mirror the bitmap as modified inside transactions.
+// xv6 transactions always commit, so updating the summary at the
+// time balloc/bfree log their bitmap change keeps it consistent
+// with what ends up on disk.
+//
+// Usage in fs.c:
+// * fsinit calls freemapinit(dev) after reading the superblock.
+// * balloc loops: b = freemap_pick(); if b < 0 the disk is full;
+//     bp = bread(dev, BBLOCK(b, sb)); bi = freemap_scan(bp, b);
+//     if bi >= 0, set its bit, log_write(bp), freemap_update(bi, -1).
+// * bfree calls freemap_update(b, 1) after clearing the bit.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+
+// most bitmap blocks a file system may have
+#define MAXBMAP 32
+
+extern struct superblock sb;
+
+struct {
+  struct spinlock lock;
+  int nbmap;              // bitmap blocks in use
+  uint nfree[MAXBMAP];    // free blocks described by each bitmap block
+  uint hint;              // block number to start the next search at
+} freemap;
+
+void
+freemapinit(int dev)
+{
+  struct buf *bp;
+  uint b, bi;
+  int i;
+
+  initlock(&freemap.lock, "freemap");
+  freemap.nbmap = (sb.size + BPB - 1) / BPB;
+  if(freemap.nbmap > MAXBMAP)
+    panic("freemapinit: too many bitmap blocks");
+  for(i = 0; i < freemap.nbmap; i++){
+    freemap.nfree[i] = 0;
+    bp = bread(dev, sb.bmapstart + i);
+    for(bi = 0; bi < BPB; bi++){
+      b = i * BPB + bi;
+      if(b >= sb.size)
+        break;
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        freemap.nfree[i]++;
+    }
+    brelse(bp);
+  }
+  freemap.hint = 0;
+}
+
+// Return a block number at which to start looking for a free
+// block: the cursor if its bitmap block has free space,
+// otherwise the start of the next bitmap block that does.
+// Returns -1 if no block is free.
+int
+freemap_pick(void)
+{
+  int i, k;
+  int b = -1;
+
+  acquire(&freemap.lock);
+  i = freemap.hint / BPB;
+  for(k = 0; k < freemap.nbmap; k++){
+    if(freemap.nfree[i] > 0){
+      b = k == 0 ? freemap.hint : i * BPB;
+      break;
+    }
+    i = (i + 1) % freemap.nbmap;
+  }
+  release(&freemap.lock);
+  return b;
+}
+
+// Search the locked bitmap buffer bp, which must be the bitmap
+// block holding start, for a clear bit.  Starts at start and
+// wraps around within the block.  Bytes that are all ones are
+// skipped a 64-bit word at a time.  Returns the block number
+// of the clear bit, or -1 if the block has none.
+int
+freemap_scan(struct buf *bp, uint start)
+{
+  uint base = start - start % BPB;
+  uint end = base + BPB < sb.size ? base + BPB : sb.size;
+  uint b, bi, pass;
+
+  for(pass = 0; pass < 2; pass++){
+    b = pass == 0 ? start : base;
+    for(; b < end && (pass == 0 || b < start); b++){
+      bi = b - base;
+      if(bi % 64 == 0 && b + 64 <= end &&
+         *(uint64*)&bp->data[bi/8] == ~(uint64)0){
+        b += 63;
+        continue;
+      }
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        return b;
+    }
+  }
+  return -1;
+}
+
+// Record that block b was allocated (delta -1) or freed (+1).
+void
+freemap_update(uint b, int delta)
+{
+  acquire(&freemap.lock);
+  freemap.nfree[b / BPB] += delta;
+  if(delta < 0)
+    freemap.hint = b + 1 < sb.size ? b + 1 : 0;
+  release(&freemap.lock);
+}
@@ -0,0 +1,387 @@
+// File-system workload generator.
+//
+// Forks nproc workers that hammer a shared pool of files with a
+// configurable mix of read, write, create and unlink operations,
+// picking files uniformly, with a Zipfian skew, or sequentially.
+// Reports total ops/sec and batch latency percentiles.
+//
+// The clock is uptime(), one tick per ~100 ms, far coarser than a
+// single op, so latency is taken over batches of -b ops: each
+// batch's ticks, divided among its ops, count once per op.  The
+// percentiles are of that batch mean, in microseconds, so a slow
+// op is averaged with its batch; they are not per-op tail latency,
+// and the keys say batch_ so nothing compares them as such.
+//
+// usage: fsbench [-p nproc] [-f nfiles] [-s filesize] [-n ops]
+//                [-m read:write:create:unlink] [-d uniform|zipf|seq]
+//                [-r seed] [-b batch]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+#include "user/benchlib.h"
+
+#define MAXPROC     16
+#define MAXFILES    256
+#define MAXFSIZE    (64*1024)
+#define IOSIZE      1024
+#define NHIST       256      // latency histogram buckets
+#define HISTUSEC    1000     // microseconds per bucket
+
+/* Access distributions: */
+#define D_UNIFORM   0
+#define D_ZIPF      1
+#define D_SEQ       2
+
+/* Operation kinds: */
+#define OP_READ     0
+#define OP_WRITE    1
+#define OP_CREATE   2
+#define OP_UNLINK   3
+#define NOP         4
+
+char *opname[NOP] = { "read", "write", "create", "unlink" };
+char *distname[] = { "uniform", "zipf", "seq" };
+
+int nproc = 4;
+int nfiles = 32;
+int fsize = 4096;
+int nops = 200;
+int batch = 32;
+int mix[NOP] = { 70, 20, 5, 5 };
+int dist = D_UNIFORM;
+uint64 seed = 1;
+
+// what each worker reports back to the parent
+struct result {
+  int ops[NOP];
+  int fails[NOP];
+  int hist[NHIST];   // hist[b] = ops whose batch mean was in bucket b;
+                     // last is overflow
+};
+
+// cumulative Zipf (theta = 1) weights, scaled to integers
+uint zipf_cdf[MAXFILES];
+
+char iobuf[IOSIZE];
+
+uint64
+rnd(void)
+{
+  // xorshift64
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+
+void
+zipf_init(void)
+{
+  uint sum = 0;
+  int i;
+
+  for(i = 0; i < nfiles; i++){
+    sum += (1 << 20) / (i + 1);
+    zipf_cdf[i] = sum;
+  }
+}
+
+int
+pick_file(int *cursor)
+{
+  uint r;
+  int lo, hi, mid;
+
+  switch(dist){
+  case D_ZIPF:
+    r = rnd() % zipf_cdf[nfiles - 1];
+    lo = 0;
+    hi = nfiles - 1;
+    while(lo < hi){
+      mid = (lo + hi) / 2;
+      if(zipf_cdf[mid] > r)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+    return lo;
+  case D_SEQ:
+    *cursor = (*cursor + 1) % nfiles;
+    return *cursor;
+  default:
+    return rnd() % nfiles;
+  }
+}
+
+int
+pick_op(void)
+{
+  int total = 0, r, i;
+
+  for(i = 0; i < NOP; i++)
+    total += mix[i];
+  r = rnd() % total;
+  for(i = 0; i < NOP; i++){
+    if(r < mix[i])
+      return i;
+    r -= mix[i];
+  }
+  return OP_READ;
+}
+
+void
+fname(char *buf, int i)
+{
+  buf[0] = 'f';
+  buf[1] = 'b';
+  buf[2] = '0' + (i / 100) % 10;
+  buf[3] = '0' + (i / 10) % 10;
+  buf[4] = '0' + i % 10;
+  buf[5] = 0;
+}
+
+// write fsize bytes to an open file
+int
+fill(int fd)
+{
+  int n, m;
+
+  for(n = 0; n < fsize; n += m){
+    m = fsize - n < IOSIZE ? fsize - n : IOSIZE;
+    if(write(fd, iobuf, m) != m)
+      return -1;
+  }
+  return 0;
+}
+
+// perform one operation on file i; returns 0 on success
+int
+do_op(int op, int i)
+{
+  char name[8];
+  int fd, n;
+
+  fname(name, i);
+  switch(op){
+  case OP_READ:
+    if((fd = open(name, O_RDONLY)) < 0)
+      return -1;
+    while((n = read(fd, iobuf, IOSIZE)) > 0)
+      ;
+    close(fd);
+    return n;
+  case OP_WRITE:
+    if((fd = open(name, O_WRONLY)) < 0)
+      return -1;
+    n = fill(fd);
+    close(fd);
+    return n;
+  case OP_CREATE:
+    if((fd = open(name, O_CREATE|O_WRONLY|O_TRUNC)) < 0)
+      return -1;
+    n = fill(fd);
+    close(fd);
+    return n;
+  case OP_UNLINK:
+    return unlink(name);
+  }
+  return -1;
+}
+
+// per-worker result file; a shared pipe could interleave partial
+// writes once it fills up
+void
+rname(char *buf, int id)
+{
+  buf[0] = 'f';
+  buf[1] = 'r';
+  buf[2] = '0' + (id / 10) % 10;
+  buf[3] = '0' + id % 10;
+  buf[4] = 0;
+}
+
+void
+worker(int id)
+{
+  struct result res;
+  char name[8];
+  int k, n, op, i, t0, b, fd;
+  int cursor = id * nfiles / nproc - 1;
+
+  memset(&res, 0, sizeof(res));
+  seed = seed * 1000003 + id + 1;
+  for(k = 0; k < nops; k += n){
+    t0 = uptime();
+    for(n = 0; n < batch && k + n < nops; n++){
+      op = pick_op();
+      i = pick_file(&cursor);
+      if(do_op(op, i) < 0)
+        res.fails[op]++;
+      res.ops[op]++;
+    }
+    b = (uptime() - t0) * (1000000 / TICKS_PER_SEC) / n / HISTUSEC;
+    res.hist[b < NHIST ? b : NHIST - 1] += n;
+  }
+  rname(name, id);
+  if((fd = open(name, O_CREATE|O_WRONLY|O_TRUNC)) < 0 ||
+     write(fd, &res, sizeof(res)) != sizeof(res)){
+    fprintf(2, "fsbench: cannot write %s\n", name);
+    exit(1);
+  }
+  close(fd);
+  exit(0);
+}
+
+// smallest latency in microseconds, to a bucket, such that at
+// least pct% of ops took no longer
+int
+percentile(int *hist, int total, int pct)
+{
+  int b, n = 0;
+
+  for(b = 0; b < NHIST; b++){
+    n += hist[b];
+    if(n * 100 >= total * pct)
+      break;
+  }
+  if(b == NHIST)
+    b = NHIST - 1;
+  return (b + 1) * HISTUSEC;
+}
+
+void
+parse_mix(char *s)
+{
+  int i;
+
+  for(i = 0; i < NOP; i++){
+    mix[i] = atoi(s);
+    while(*s >= '0' && *s <= '9')
+      s++;
+    if(i < NOP - 1){
+      if(*s != ':')
+        benchusage();
+      s++;
+    }
+  }
+  if(mix[0] + mix[1] + mix[2] + mix[3] <= 0)
+    benchusage();
+}
+
+void
+parse_dist(char *s)
+{
+  if(strcmp(s, "uniform") == 0)
+    dist = D_UNIFORM;
+  else if(strcmp(s, "zipf") == 0)
+    dist = D_ZIPF;
+  else if(strcmp(s, "seq") == 0)
+    dist = D_SEQ;
+  else
+    benchusage();
+}
+
+void
+parse_seed(char *s)
+{
+  seed = atoi(s);
+}
+
+struct benchopt opts[] = {
+  { 'p', &nproc },
+  { 'f', &nfiles },
+  { 's', &fsize },
+  { 'n', &nops },
+  { 'b', &batch },
+  { 'r', 0, parse_seed },
+  { 'm', 0, parse_mix },
+  { 'd', 0, parse_dist },
+  { 0 },
+};
+
+int
+main(int argc, char *argv[])
+{
+  struct result res, total;
+  int fd, i, j, t0, elapsed, nall, nfail;
+  char name[8];
+
+  benchinit("fsbench", "[-p nproc] [-f nfiles] [-s filesize] [-n ops] "
+            "[-m r:w:c:u] [-d uniform|zipf|seq] [-r seed] [-b batch]");
+  benchargs(argc, argv, opts);
+  if(nproc < 1 || nproc > MAXPROC || nfiles < 1 || nfiles > MAXFILES ||
+     fsize < 0 || fsize > MAXFSIZE || nops < 1 || seed == 0 || batch < 1)
+    benchusage();
+
+  zipf_init();
+  memset(iobuf, 'x', IOSIZE);
+
+  // populate the file pool before the clock starts
+  for(i = 0; i < nfiles; i++){
+    fname(name, i);
+    if((fd = open(name, O_CREATE|O_WRONLY|O_TRUNC)) < 0 || fill(fd) < 0){
+      fprintf(2, "fsbench: cannot create %s\n", name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0)
+      benchdie("fork");
+    if(pid == 0)
+      worker(i);
+  }
+  for(i = 0; i < nproc; i++)
+    wait(0);
+  elapsed = uptime() - t0;
+
+  memset(&total, 0, sizeof(total));
+  for(i = 0; i < nproc; i++){
+    rname(name, i);
+    if((fd = open(name, O_RDONLY)) < 0 ||
+       read(fd, &res, sizeof(res)) != sizeof(res)){
+      fprintf(2, "fsbench: missing result from worker %d\n", i);
+      exit(1);
+    }
+    close(fd);
+    unlink(name);
+    for(j = 0; j < NOP; j++){
+      total.ops[j] += res.ops[j];
+      total.fails[j] += res.fails[j];
+    }
+    for(j = 0; j < NHIST; j++)
+      total.hist[j] += res.hist[j];
+  }
+
+  for(i = 0; i < nfiles; i++){
+    fname(name, i);
+    unlink(name);
+  }
+
+  nall = nfail = 0;
+  for(j = 0; j < NOP; j++){
+    nall += total.ops[j];
+    nfail += total.fails[j];
+    printf("fsbench: %s %d ops, %d failed\n", opname[j], total.ops[j],
+           total.fails[j]);
+  }
+  printf("fsbench: %d ops in %d ticks, %d ops/sec\n", nall, elapsed,
+         benchpersec(nall, elapsed));
+  printf("fsbench: batch mean latency usec, batches of %d: "
+         "p50 %d p90 %d p99 %d\n", batch,
+         percentile(total.hist, nall, 50), percentile(total.hist, nall, 90),
+         percentile(total.hist, nall, 99));
+  printf("BENCH fsbench nproc=%d nfiles=%d fsize=%d dist=%s ops=%d fails=%d "
+         "ticks=%d ops_per_sec=%d batch=%d batch_p50_usec=%d batch_p90_usec=%d "
+         "batch_p99_usec=%d\n",
+         nproc, nfiles, fsize, distname[dist], nall, nfail, elapsed,
+         benchpersec(nall, elapsed), batch,
+         percentile(total.hist, nall, 50), percentile(total.hist, nall, 90),
+         percentile(total.hist, nall, 99));
+  exit(0);
+}
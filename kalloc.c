@@ -7,6 +7,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "proc.h"
 #include "defs.h"
 
 #define NAMELEN 8
@@ -28,6 +29,37 @@ struct {
 
 char lock_name[NCPU][NAMELEN];
 
+// One bit per physical page: set while the page is on a free list.
+// Lets kalloc_contig find aligned runs of free pages.
+#define NPHYSPAGES ((PHYSTOP - KERNBASE) / PGSIZE)
+uint64 pgfree[NPHYSPAGES / 64];
+
+#define PGINDEX(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
+// largest run kalloc_contig hands out: one 2MB megapage
+#define MAXCONTIG 512
+// windows kcompact tries before giving up
+#define NCOMPACT_TRIES 4
+// destination pages kmigrate allocates at a time
+#define NMIGRATE 8
+
+// References to each physical page: set to 1 by kalloc, raised
+// by kref for every extra mapping, and dropped by kfree, which
+// only frees the page when the last reference goes.
+int pgref[NPHYSPAGES];
+
+// One bit per physical page: set while the page is a merged
+// (same-page merging) page that ksm.c may hand out more
+// references to.  Cleared when the page is freed.
+uint64 pgmerged[NPHYSPAGES / 64];
+
+uint64 kcontig_ok;    // kalloc_contig successes
+uint64 kcontig_fail;  // kalloc_contig failures
+uint64 kmoves;        // user pages migrated by kcompact
+extern uint64 uvmgen; // see ucopy.c
+
+extern struct proc proc[NPROC];
+
 void
 kinit()
 {
@@ -47,24 +79,36 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    pgref[PGINDEX(p)] = 1;
     kfree(p);
+  }
 }
 
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// If the page has other references, just drop this one.
 void
 kfree(void *pa)
 {
   struct run *r;
+  int ref;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  ref = __sync_sub_and_fetch(&pgref[PGINDEX(pa)], 1);
+  if(ref > 0)
+    return;
+  if(ref < 0)
+    panic("kfree: ref");
+  __sync_fetch_and_and(&pgmerged[PGINDEX(pa) / 64],
+                       ~(1L << (PGINDEX(pa) % 64)));
+
   // Fill with junk to catch dangling refs.
-  memset(pa, 1, PGSIZE);
+  fillwords(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
   
@@ -75,6 +119,7 @@ kfree(void *pa)
   acquire(&kmem[id].lock);
   r->next = kmem[id].freelist;
   kmem[id].freelist = r;
+  __sync_fetch_and_or(&pgfree[PGINDEX(r) / 64], 1L << (PGINDEX(r) % 64));
   release(&kmem[id].lock);
   pop_off();
 }
@@ -115,10 +160,282 @@ kalloc(void)
     }
   }
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
+  if(r){
+    __sync_fetch_and_and(&pgfree[PGINDEX(r) / 64], ~(1L << (PGINDEX(r) % 64)));
+    pgref[PGINDEX(r)] = 1;
+    fillwords((char*)r, 5, PGSIZE); // fill with junk
+  }
 
   pop_off();
 
   return (void*)r;
 }
+
+// Add a reference to the allocated page at pa.
+void
+kref(void *pa)
+{
+  if(__sync_fetch_and_add(&pgref[PGINDEX(pa)], 1) <= 0)
+    panic("kref");
+}
+
+// Add a reference to the page at pa unless it is free.
+// Returns 1 if a reference was taken.
+int
+krefget(void *pa)
+{
+  int ref;
+
+  do {
+    ref = pgref[PGINDEX(pa)];
+    if(ref <= 0)
+      return 0;
+  } while(!__sync_bool_compare_and_swap(&pgref[PGINDEX(pa)], ref, ref + 1));
+  return 1;
+}
+
+// Number of references to the page at pa.
+int
+krefcnt(void *pa)
+{
+  return pgref[PGINDEX(pa)];
+}
+
+// Mark or unmark the allocated page at pa as merged.
+void
+kmarkmerged(void *pa, int on)
+{
+  if(on)
+    __sync_fetch_and_or(&pgmerged[PGINDEX(pa) / 64],
+                        1L << (PGINDEX(pa) % 64));
+  else
+    __sync_fetch_and_and(&pgmerged[PGINDEX(pa) / 64],
+                         ~(1L << (PGINDEX(pa) % 64)));
+}
+
+int
+kmerged(void *pa)
+{
+  return (pgmerged[PGINDEX(pa) / 64] >> (PGINDEX(pa) % 64)) & 1;
+}
+
+static int
+isfree(uint64 pa)
+{
+  return (pgfree[PGINDEX(pa) / 64] >> (PGINDEX(pa) % 64)) & 1;
+}
+
+// Take every free page in the npages-page window at base off
+// the free lists, recording each one in resv (a bit per page
+// of the window).  Returns the number of pages newly taken.
+static int
+kreserve(uint64 base, int npages, uint64 *resv)
+{
+  struct run **pp, *r;
+  int i, n = 0;
+
+  for(i = 0; i < NCPU; i++)
+    acquire(&kmem[i].lock);
+  for(i = 0; i < NCPU; i++){
+    for(pp = &kmem[i].freelist; (r = *pp) != 0; ){
+      if((uint64)r >= base && (uint64)r < base + npages * PGSIZE){
+        *pp = r->next;
+        __sync_fetch_and_and(&pgfree[PGINDEX(r) / 64],
+                             ~(1L << (PGINDEX(r) % 64)));
+        pgref[PGINDEX(r)] = 1;
+        resv[((uint64)r - base) / PGSIZE / 64] |=
+          1L << (((uint64)r - base) / PGSIZE % 64);
+        n++;
+      } else
+        pp = &r->next;
+    }
+  }
+  for(i = NCPU - 1; i >= 0; i--)
+    release(&kmem[i].lock);
+  return n;
+}
+
+// Add up to want pages to the list of destinations at *list,
+// keeping any that kalloc hands out from inside the window for
+// it, marked in resv.  Returns how many were added.
+static int
+kspare(struct run **list, int want, uint64 base, int npages, uint64 *resv)
+{
+  struct run *r;
+  uint64 i;
+  int n = 0;
+
+  while(n < want && (r = kalloc()) != 0){
+    if((uint64)r >= base && (uint64)r < base + npages * PGSIZE){
+      i = ((uint64)r - base) / PGSIZE;
+      resv[i / 64] |= 1L << (i % 64);
+      continue;
+    }
+    r->next = *list;
+    *list = r;
+    n++;
+  }
+  return n;
+}
+
+// Move every user page mapped inside the window at base to a
+// page outside it, marking the vacated pages in resv.  Skips
+// processes that are running, since their hart may be using the
+// old page.  Returns the number of pages moved.
+static int
+kmigrate(uint64 base, int npages, uint64 *resv)
+{
+  struct proc *p;
+  struct run *spare = 0, *r;
+  uint64 va, pa, i;
+  pte_t *pte;
+  int n = 0, nspare = 0, moved;
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    va = 0;
+    do {
+      // allocate destinations before taking p->lock, so no
+      // allocator locks or reclaim ever nest inside it
+      nspare += kspare(&spare, NMIGRATE - nspare, base, npages, resv);
+      if(nspare == 0)
+        goto out;
+      acquire(&p->lock);
+      if(p->state == UNUSED || p->state == RUNNING || p->pagetable == 0){
+        release(&p->lock);
+        break;
+      }
+      moved = 0;
+      for(; va < p->sz && nspare > 0; va += PGSIZE){
+        if((pte = walk(p->pagetable, va, 0)) == 0)
+          continue;
+        if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+          continue;
+        pa = PTE2PA(*pte);
+        if(pa < base || pa >= base + npages * PGSIZE)
+          continue;
+        // mapped elsewhere too, or open to new mappings
+        if(pgref[PGINDEX(pa)] != 1 || kmerged((void*)pa))
+          continue;
+        r = spare;
+        spare = r->next;
+        nspare--;
+        memmove(r, (void*)pa, PGSIZE);
+        *pte = PA2PTE(r) | PTE_FLAGS(*pte);
+        i = (pa - base) / PGSIZE;
+        resv[i / 64] |= 1L << (i % 64);
+        moved++;
+      }
+      if(moved){
+        __sync_fetch_and_add(&kmoves, moved);
+        __sync_fetch_and_add(&uvmgen, 1);
+      }
+      release(&p->lock);
+      n += moved;
+    } while(va < p->sz);
+  }
+out:
+  // destinations left over go back
+  while((r = spare) != 0){
+    spare = r->next;
+    kfree(r);
+  }
+  return n;
+}
+
+// Try to empty an aligned window of npages by migrating user
+// pages out of it, choosing the windows that are already the
+// most free.  Returns the window, taken off the free lists,
+// or 0 if no window could be emptied.
+static void*
+kcompact(int npages)
+{
+  uint64 resv[MAXCONTIG / 64];
+  uint64 tried[NCOMPACT_TRIES];
+  uint64 base, best, pa, start;
+  int t, k, nfree, bestfree, n, i;
+
+  start = PGROUNDUP((uint64)end);
+  start = (start + npages * PGSIZE - 1) / (npages * PGSIZE) * (npages * PGSIZE);
+  for(t = 0; t < NCOMPACT_TRIES; t++){
+    best = 0;
+    bestfree = -1;
+    for(base = start; base + npages * PGSIZE <= PHYSTOP;
+        base += npages * PGSIZE){
+      for(k = 0; k < t && tried[k] != base; k++)
+        ;
+      if(k < t)
+        continue;
+      nfree = 0;
+      for(pa = base; pa < base + npages * PGSIZE; pa += PGSIZE)
+        nfree += isfree(pa);
+      if(nfree > bestfree){
+        best = base;
+        bestfree = nfree;
+      }
+    }
+    if(bestfree < 0)
+      break;
+    tried[t] = best;
+
+    memset(resv, 0, sizeof(resv));
+    kreserve(best, npages, resv);
+    kmigrate(best, npages, resv);
+    // pick up pages freed into the window meanwhile
+    kreserve(best, npages, resv);
+
+    n = 0;
+    for(i = 0; i < npages; i++)
+      n += (resv[i / 64] >> (i % 64)) & 1;
+    if(n == npages)
+      return (void*)best;
+    for(i = 0; i < npages; i++)
+      if((resv[i / 64] >> (i % 64)) & 1)
+        kfree((void*)(best + i * PGSIZE));
+  }
+  return 0;
+}
+
+// Allocate npages physically contiguous pages, aligned to
+// npages * PGSIZE.  npages must be a power of two no larger
+// than MAXCONTIG.  Compacts memory if no free run exists.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_contig(int npages)
+{
+  uint64 resv[MAXCONTIG / 64];
+  uint64 base, pa;
+  void *p = 0;
+  int i;
+
+  if(npages <= 0 || npages > MAXCONTIG || (npages & (npages - 1)))
+    return 0;
+
+  base = PGROUNDUP((uint64)end);
+  base = (base + npages * PGSIZE - 1) / (npages * PGSIZE) * (npages * PGSIZE);
+  for(; p == 0 && base + npages * PGSIZE <= PHYSTOP; base += npages * PGSIZE){
+    for(pa = base; pa < base + npages * PGSIZE && isfree(pa); pa += PGSIZE)
+      ;
+    if(pa < base + npages * PGSIZE)
+      continue;
+    memset(resv, 0, sizeof(resv));
+    if(kreserve(base, npages, resv) == npages){
+      p = (void*)base;
+      break;
+    }
+    // lost a race for part of it; give back what was taken
+    for(i = 0; i < npages; i++)
+      if((resv[i / 64] >> (i % 64)) & 1)
+        kfree((void*)(base + i * PGSIZE));
+  }
+
+  if(p == 0)
+    p = kcompact(npages);
+  if(p == 0){
+    __sync_fetch_and_add(&kcontig_fail, 1);
+    return 0;
+  }
+  __sync_fetch_and_add(&kcontig_ok, 1);
+  for(i = 0; i < npages; i++)
+    fillwords((char*)p + i * PGSIZE, 5, PGSIZE); // fill with junk
+  return p;
+}
@@ -0,0 +1,161 @@
+// Same-page merging.
+//
+// ksmscan walks the user pages of every process, hashes each one
+// and looks the hash up in a table of merge candidates.  When the
+// candidate's contents really are identical, the page is remapped
+// to the candidate, read-only and copy-on-write (see cow.c), and
+// its own frame is freed.  Otherwise the page becomes the
+// candidate for its hash, which also makes it read-only until the
+// next write.
+//
+// Candidates are marked "merged" in kalloc.c.  A write to a
+// candidate that nobody else maps clears the mark (cowfault), and
+// freeing it does too, so a stale table slot is detected by taking
+// a reference with krefget and checking the mark is still set.
+//
+// xv6 has no kernel threads, so scanning runs on demand, e.g. from
+// a system call that a background user process makes periodically.
+//
+// Locking: p->lock, then ksmlock.  Only processes that are not
+// running are scanned, so no hart holds a stale writable TLB entry
+// for a page being made read-only; xv6 flushes the TLB on every
+// return to user space.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+#include "cow.h"
+
+#define NKSM 1024   // candidate table slots
+
+struct spinlock ksmlock;
+
+struct {
+  uint64 hash;
+  uint64 pa;    // 0 if the slot is empty
+} ksmtab[NKSM];
+
+uint64 ksm_scanned;   // pages hashed
+uint64 ksm_merged;    // pages remapped onto a candidate
+uint64 ksm_ticks;     // time spent scanning
+
+extern struct proc proc[NPROC];
+extern uint64 ncowcopy;
+extern uint64 uvmgen;   // see ucopy.c
+
+void
+ksminit(void)
+{
+  initlock(&ksmlock, "ksm");
+}
+
+static uint64
+pghash(uint64 *p)
+{
+  uint64 h = 0xcbf29ce484222325;
+  int i;
+
+  for(i = 0; i < PGSIZE / sizeof(uint64); i++)
+    h = (h ^ p[i]) * 0x100000001b3;
+  return h;
+}
+
+// Write-protect the mapping at pte, remembering in PTE_COW
+// that it was writable.
+static void
+protect(pte_t *pte)
+{
+  if(*pte & PTE_W)
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+}
+
+// Merge the user page mapped at pte into an identical candidate,
+// or make it the candidate for its hash.  Returns 1 if merged.
+// Sets *changed if the mapping was altered at all.
+// Caller holds ksmlock and the lock of the page's process.
+static int
+ksm_one(pte_t *pte, int *changed)
+{
+  uint64 pa = PTE2PA(*pte);
+  uint64 h, cpa;
+  int i;
+
+  // already a candidate, or shared some other way
+  if(kmerged((void*)pa) || krefcnt((void*)pa) != 1)
+    return 0;
+
+  h = pghash((uint64*)pa);
+  ksm_scanned++;
+  i = h % NKSM;
+  cpa = ksmtab[i].pa;
+  if(cpa && krefget((void*)cpa)){
+    if(kmerged((void*)cpa) && ksmtab[i].hash == h &&
+       memcmp((void*)cpa, (void*)pa, PGSIZE) == 0){
+      protect(pte);
+      *pte = PA2PTE(cpa) | PTE_FLAGS(*pte);
+      kfree((void*)pa);
+      ksm_merged++;
+      *changed = 1;
+      return 1;
+    }
+    if(kmerged((void*)cpa)){
+      // a live candidate with other contents keeps its slot
+      kfree((void*)cpa);
+      return 0;
+    }
+    kfree((void*)cpa);
+  }
+
+  ksmtab[i].hash = h;
+  ksmtab[i].pa = pa;
+  kmarkmerged((void*)pa, 1);
+  protect(pte);
+  *changed = 1;
+  return 0;
+}
+
+// Scan every process that is not running and merge identical
+// user pages.  Returns the number of pages merged.
+int
+ksmscan(void)
+{
+  struct proc *p;
+  uint64 va;
+  pte_t *pte;
+  uint t0 = ticks;
+  int n = 0, changed;
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->state == UNUSED || p->state == RUNNING || p->pagetable == 0){
+      release(&p->lock);
+      continue;
+    }
+    acquire(&ksmlock);
+    changed = 0;
+    for(va = 0; va < p->sz; va += PGSIZE){
+      if((pte = walk(p->pagetable, va, 0)) == 0)
+        continue;
+      if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+        continue;
+      n += ksm_one(pte, &changed);
+    }
+    // p's PTEs went read-only; see ucopy.c
+    if(changed)
+      __sync_fetch_and_add(&uvmgen, 1);
+    release(&ksmlock);
+    release(&p->lock);
+  }
+  __sync_fetch_and_add(&ksm_ticks, ticks - t0);
+  return n;
+}
+
+void
+ksmstats(void)
+{
+  printf("ksm: %d pages scanned, %d merged, %d unshared by writes, %d ticks\n",
+         (int)ksm_scanned, (int)ksm_merged, (int)ncowcopy, (int)ksm_ticks);
+}
@@ -0,0 +1,93 @@
+// Page fill and block copy bandwidth.
+//
+// Times xv6's byte-at-a-time memset and memmove against the
+// word-at-a-time fillwords and copywords (memword.c) that the
+// kernel uses for kalloc/kfree page fills and buffer copies, on
+// page-sized fills and BSIZE-sized copies.
+//
+// usage: membench [-n mbytes]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+#include "user/benchlib.h"
+
+#define PGSIZE      4096
+
+void fillwords(void*, int, uint);
+void copywords(void*, const void*, uint);
+
+int mbytes = 64;
+
+uint64 page[PGSIZE / sizeof(uint64)];
+uint64 src[BSIZE / sizeof(uint64)];
+uint64 dst[BSIZE / sizeof(uint64)];
+
+struct benchopt opts[] = {
+  { 'n', &mbytes },
+  { 0 },
+};
+
+// mbytes moved in ticks, in KB per second
+int
+rate(int ticks)
+{
+  return benchpersec(mbytes * 1024, ticks);
+}
+
+// Ticks to fill mbytes of page-sized buffers, word-wise or not.
+int
+bench_fill(int words)
+{
+  int i, n = mbytes * (1024 * 1024 / PGSIZE), t0 = uptime();
+
+  for(i = 0; i < n; i++){
+    if(words)
+      fillwords(page, i, PGSIZE);
+    else
+      memset(page, i, PGSIZE);
+  }
+  return uptime() - t0;
+}
+
+// Ticks to copy mbytes in BSIZE blocks, word-wise or not.
+int
+bench_copy(int words)
+{
+  int i, n = mbytes * (1024 * 1024 / BSIZE), t0 = uptime();
+
+  for(i = 0; i < n; i++){
+    if(words)
+      copywords(dst, src, BSIZE);
+    else
+      memmove(dst, src, BSIZE);
+  }
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fb, fw, cb, cw;
+
+  benchinit("membench", "[-n mbytes]");
+  benchargs(argc, argv, opts);
+  if(mbytes < 1)
+    benchusage();
+
+  fb = bench_fill(0);
+  fw = bench_fill(1);
+  cb = bench_copy(0);
+  cw = bench_copy(1);
+
+  printf("membench: %d MB each\n", mbytes);
+  printf("membench: page fill  memset %d KB/s, fillwords %d KB/s\n",
+         rate(fb), rate(fw));
+  printf("membench: block copy memmove %d KB/s, copywords %d KB/s\n",
+         rate(cb), rate(cw));
+  printf("BENCH membench mbytes=%d fill_byte_kbps=%d fill_word_kbps=%d "
+         "copy_byte_kbps=%d copy_word_kbps=%d\n",
+         mbytes, rate(fb), rate(fw), rate(cb), rate(cw));
+  exit(0);
+}
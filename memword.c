@@ -0,0 +1,99 @@
+// Word-at-a-time memory primitives.
+//
+// xv6's memset and memmove move one byte per loop iteration.  These
+// move 64-bit words, eight per iteration, whenever the pointers and
+// the length allow, and fall back to the byte loops for the rest.
+// Used for kalloc/kfree page fills, copies into user pages
+// (ucopy.c) and zero-block detection in the buffer cache (bio.c).
+//
+// The file includes nothing but types.h, so the same source is
+// also linked into user programs (ULIB gains memword.o) for
+// membench to measure against the byte loops.  There is no vector
+// (RVV) path: the qemu virt machine xv6 targets runs without the V
+// extension by default, and the scalar loop already does a store
+// per cycle.
+
+#include "types.h"
+
+#define WALIGNED(x) (((uint64)(x) & (sizeof(uint64) - 1)) == 0)
+
+// Set n bytes at dst to c.
+void
+fillwords(void *dst, int c, uint n)
+{
+  uint64 v = (uchar)c;
+  uint64 *p = dst;
+  char *b;
+
+  v |= v << 8;
+  v |= v << 16;
+  v |= v << 32;
+  if(WALIGNED(dst)){
+    for(; n >= 64; n -= 64, p += 8){
+      p[0] = v;
+      p[1] = v;
+      p[2] = v;
+      p[3] = v;
+      p[4] = v;
+      p[5] = v;
+      p[6] = v;
+      p[7] = v;
+    }
+    for(; n >= 8; n -= 8)
+      *p++ = v;
+  }
+  for(b = (char*)p; n > 0; n--)
+    *b++ = c;
+}
+
+// Copy n bytes from src to dst, which must not overlap.
+void
+copywords(void *dst, const void *src, uint n)
+{
+  uint64 *d = dst;
+  const uint64 *s = src;
+  char *bd;
+  const char *bs;
+
+  if(WALIGNED(dst) && WALIGNED(src)){
+    for(; n >= 64; n -= 64, d += 8, s += 8){
+      d[0] = s[0];
+      d[1] = s[1];
+      d[2] = s[2];
+      d[3] = s[3];
+      d[4] = s[4];
+      d[5] = s[5];
+      d[6] = s[6];
+      d[7] = s[7];
+    }
+    for(; n >= 8; n -= 8)
+      *d++ = *s++;
+  }
+  bd = (char*)d;
+  bs = (const char*)s;
+  while(n-- > 0)
+    *bd++ = *bs++;
+}
+
+// Is every one of the n bytes at src zero?  Stops at the first
+// eight-word step that is not.
+int
+zerowords(const void *src, uint n)
+{
+  const uint64 *p = src;
+  const char *b;
+
+  if(WALIGNED(src)){
+    for(; n >= 64; n -= 64, p += 8){
+      if(p[0] | p[1] | p[2] | p[3] | p[4] | p[5] | p[6] | p[7])
+        return 0;
+    }
+    for(; n >= 8; n -= 8)
+      if(*p++)
+        return 0;
+  }
+  for(b = (const char*)p; n > 0; n--)
+    if(*b++)
+      return 0;
+  return 1;
+}
@@ -0,0 +1,174 @@
+// Directory name lookup cache.
+//
+// Maps (dev, directory inode number, name) to the inode number the
+// name refers to, so namex can resolve a path component without
+// scanning the directory's blocks through the buffer cache.
+// An entry with inum 0 is negative: the name is known to be absent.
+//
+// Lookups vastly outnumber updates, so readers take no lock.
+// Each bucket has a sequence count that writers, serialized by the
+// bucket's spinlock, make odd while they change the bucket and even
+// again when done.  A reader that sees an odd count, or a different
+// count after its search, searches again.
+//
+// Keeping it coherent, in fs.c and sysfile.c:
+// * dirlookup calls ncache_lookup first, and ncache_enter with
+//     the result, found or not, after scanning the directory.
+//     The cache holds no directory offsets, so when poff is not
+//     null (sys_unlink, or any caller that goes on to rewrite the
+//     entry) dirlookup skips the cache and scans.
+// * dirlink calls ncache_enter with the new inode number.
+// * sys_unlink calls ncache_remove for the name it unlinks.
+// * when a directory inode is freed, ncache_purgedir drops every
+//     entry under it, since its inode number will be reused.
+// dirlookup and dirlink run with the directory inode locked, so a
+// negative entry cannot be entered behind a concurrent create.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+
+#define NNBUCKET 61
+#define NNWAY    4    // entries per bucket
+
+struct nentry {
+  uint dev;
+  uint dinum;           // directory; 0 if the entry is unused
+  char name[DIRSIZ];
+  uint inum;            // 0 for a negative entry
+};
+
+struct {
+  struct spinlock lock;
+  volatile uint seq;    // odd while a writer is changing the bucket
+  int next;             // way to replace next
+  struct nentry e[NNWAY];
+} ncache[NNBUCKET];
+
+void
+ncacheinit(void)
+{
+  int i;
+
+  for(i = 0; i < NNBUCKET; i++)
+    initlock(&ncache[i].lock, "ncache");
+}
+
+static int
+nhash(uint dev, uint dinum, char *name)
+{
+  uint h = dev * 31 + dinum;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 33 + (uchar)name[i];
+  return h % NNBUCKET;
+}
+
+// Caller holds the bucket's lock or is retrying under its seq.
+static struct nentry*
+nfind(int h, uint dev, uint dinum, char *name)
+{
+  struct nentry *e;
+
+  for(e = ncache[h].e; e < ncache[h].e + NNWAY; e++)
+    if(e->dinum == dinum && e->dev == dev &&
+       strncmp(e->name, name, DIRSIZ) == 0)
+      return e;
+  return 0;
+}
+
+// Look name up in directory dinum without taking a lock.
+// Returns 1 and sets *inum (0 if the name is known not to
+// exist) on a cache hit, or 0 if the cache does not know.
+int
+ncache_lookup(uint dev, uint dinum, char *name, uint *inum)
+{
+  struct nentry *e;
+  uint seq, found, v;
+  int h = nhash(dev, dinum, name);
+
+  do {
+    seq = ncache[h].seq;
+    __sync_synchronize();
+    found = 0;
+    v = 0;
+    if((seq & 1) == 0 && (e = nfind(h, dev, dinum, name)) != 0){
+      found = 1;
+      v = e->inum;
+    }
+    __sync_synchronize();
+  } while((seq & 1) || ncache[h].seq != seq);
+
+  if(found)
+    *inum = v;
+  return found;
+}
+
+static void
+write_begin(int h)
+{
+  acquire(&ncache[h].lock);
+  ncache[h].seq++;
+  __sync_synchronize();
+}
+
+static void
+write_end(int h)
+{
+  __sync_synchronize();
+  ncache[h].seq++;
+  release(&ncache[h].lock);
+}
+
+// Record that name in directory dinum refers to inum,
+// or is absent if inum is 0.
+void
+ncache_enter(uint dev, uint dinum, char *name, uint inum)
+{
+  struct nentry *e;
+  int h = nhash(dev, dinum, name);
+
+  write_begin(h);
+  if((e = nfind(h, dev, dinum, name)) == 0){
+    e = &ncache[h].e[ncache[h].next];
+    ncache[h].next = (ncache[h].next + 1) % NNWAY;
+    e->dev = dev;
+    e->dinum = dinum;
+    strncpy(e->name, name, DIRSIZ);
+  }
+  e->inum = inum;
+  write_end(h);
+}
+
+// Forget name in directory dinum.
+void
+ncache_remove(uint dev, uint dinum, char *name)
+{
+  struct nentry *e;
+  int h = nhash(dev, dinum, name);
+
+  write_begin(h);
+  if((e = nfind(h, dev, dinum, name)) != 0)
+    e->dinum = 0;
+  write_end(h);
+}
+
+// Forget every name in directory dinum.
+void
+ncache_purgedir(uint dev, uint dinum)
+{
+  struct nentry *e;
+  int h;
+
+  for(h = 0; h < NNBUCKET; h++){
+    write_begin(h);
+    for(e = ncache[h].e; e < ncache[h].e + NNWAY; e++)
+      if(e->dinum == dinum && e->dev == dev)
+        e->dinum = 0;
+    write_end(h);
+  }
+}
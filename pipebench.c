@@ -0,0 +1,86 @@
+// Pipe streaming throughput, copying vs. page flipping.
+//
+// A child streams total bytes to the parent through a pipe, in
+// page-sized writes.  The first run uses buffers that start one
+// word past a page boundary, so every byte is copied as before;
+// the second uses page-aligned buffers, so whole pages move by
+// page flipping (pipeflip.c).  The producer stores into its buffer
+// before every write, as a real one would, so the flipped run pays
+// for its copy-on-write faults.
+//
+// usage: pipebench [-t total-kbytes]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "user/benchlib.h"
+
+#define PGSIZE      4096
+
+int kbytes = 8192;
+int total;          // bytes, a whole number of pages
+
+struct benchopt opts[] = {
+  { 't', &kbytes },
+  { 0 },
+};
+
+// Ticks to stream total bytes from wbuf in a child to rbuf here.
+int
+stream(char *wbuf, char *rbuf)
+{
+  int fds[2], t0, n, m, got = 0;
+
+  if(pipe(fds) < 0)
+    benchdie("pipe");
+  t0 = uptime();
+  if(fork() == 0){
+    close(fds[0]);
+    for(n = 0; n < total; n += PGSIZE){
+      wbuf[0] = n;
+      if(write(fds[1], wbuf, PGSIZE) != PGSIZE)
+        benchdie("write");
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  while(got < total && (m = read(fds[0], rbuf, PGSIZE)) > 0)
+    got += m;
+  close(fds[0]);
+  wait(0);
+  if(got != total)
+    benchdie("transfer");
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *mem, *page;
+  int tcopy, tflip;
+
+  benchinit("pipebench", "[-t total-kbytes]");
+  benchargs(argc, argv, opts);
+  total = kbytes * 1024;
+  total -= total % PGSIZE;
+  if(total <= 0)
+    benchusage();
+
+  // two buffers of a page each, plus room to align and offset them
+  if((mem = malloc(4 * PGSIZE)) == 0)
+    benchdie("malloc");
+  page = (char*)(((uint64)mem + PGSIZE - 1) & ~(PGSIZE - 1));
+  memset(page, 'x', 2 * PGSIZE + 8);
+
+  tcopy = stream(page + 8, page + PGSIZE + 8);
+  tflip = stream(page, page + PGSIZE);
+
+  printf("pipebench: %d KB in page-sized writes\n", total / 1024);
+  printf("pipebench: unaligned (copy) %d ticks, %d KB/s\n",
+         tcopy, benchkbps(total, tcopy));
+  printf("pipebench: aligned (flip)   %d ticks, %d KB/s\n",
+         tflip, benchkbps(total, tflip));
+  printf("BENCH pipebench kbytes=%d copy_kbps=%d flip_kbps=%d\n",
+         total / 1024, benchkbps(total, tcopy), benchkbps(total, tflip));
+  exit(0);
+}
@@ -0,0 +1,133 @@
+// Zero-copy pipe transfers by page flipping.
+//
+// pipewrite copies each byte into the pipe's buffer and piperead
+// copies it out again.  For a page-aligned write of whole pages
+// the pipe can instead take the writer's page itself: the page is
+// queued with a reference of its own, and the writer's mapping
+// becomes read-only copy-on-write.  A reader whose buffer is a
+// whole, aligned page gets the page mapped in place of its own,
+// also copy-on-write; any other read copies out of the queued page.
+// Whichever side writes to the page first gets a private copy from
+// cowfault, and the last one to touch it may reuse it in place.
+//
+// Stream order is kept by never mixing the two paths: a page is
+// only queued when the byte buffer is empty, and bytes are only
+// buffered when no page is queued.
+//
+// Hooks in pipe.c (struct pipe gains a struct flipq fq):
+// * pipewrite, while pi->nwrite == pi->nread, offers each aligned
+//     whole page to flip_put and falls back to copying when it
+//     returns -1; with pages queued, the byte path sleeps until
+//     flip_bytes is 0.
+// * piperead calls flip_get while flip_bytes is nonzero, and
+//     counts flip_bytes as readable data when deciding to sleep.
+// * pipeclose calls flip_drain once both ends are closed.
+// All of these run with pi->lock held.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+#include "cow.h"
+#include "pipeflip.h"
+
+uint64 nflip;       // pages queued instead of copied
+uint64 nflipmap;    // pages mapped straight into a reader
+
+// Can the page behind pte be made copy-on-write?  Not a text
+// page, read-only without PTE_COW, nor a writable page that is
+// shared on purpose (shm.c).
+static int
+flippable(pte_t *pte)
+{
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return 0;
+  if(*pte & PTE_COW)
+    return 1;
+  return (*pte & PTE_W) && krefcnt((void*)PTE2PA(*pte)) == 1;
+}
+
+// Bytes waiting in the queue.
+int
+flip_bytes(struct flipq *q)
+{
+  return (q->nwrite - q->nread) * PGSIZE - q->off;
+}
+
+// Queue the writer's page at va, aligned, instead of copying it.
+// Returns 0 on success, or -1 if the caller must copy: the queue
+// is full, or the page is not a plain writable user page.
+int
+flip_put(struct flipq *q, uint64 va)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint64 pa;
+
+  if(q->nwrite - q->nread == NFLIP || va >= MAXVA)
+    return -1;
+  if((pte = walk(p->pagetable, va, 0)) == 0)
+    return -1;
+  if(!flippable(pte))
+    return -1;
+
+  acquire(&p->lock);
+  pa = PTE2PA(*pte);
+  kref((void*)pa);
+  *pte = (*pte & ~PTE_W) | PTE_COW;
+  release(&p->lock);
+  sfence_vma();
+
+  q->pa[q->nwrite++ % NFLIP] = pa;
+  __sync_fetch_and_add(&nflip, 1);
+  return 0;
+}
+
+// Deliver up to n bytes from the queue to the reader at dst.
+// A whole aligned page is mapped there; otherwise bytes are
+// copied.  Returns the bytes delivered, or -1 on a bad address.
+int
+flip_get(struct flipq *q, uint64 dst, int n)
+{
+  struct proc *p = myproc();
+  uint64 pa = q->pa[q->nread % NFLIP];
+  pte_t *pte;
+  uint64 old;
+
+  if(q->off == 0 && n >= PGSIZE && (dst % PGSIZE) == 0 && dst < MAXVA &&
+     (pte = walk(p->pagetable, dst, 0)) != 0 && flippable(pte)){
+    // the queue's reference becomes the reader's mapping
+    acquire(&p->lock);
+    old = PTE2PA(*pte);
+    *pte = PA2PTE(pa) | ((PTE_FLAGS(*pte) & ~PTE_W) | PTE_COW);
+    release(&p->lock);
+    sfence_vma();
+    kfree((void*)old);
+    q->nread++;
+    __sync_fetch_and_add(&nflipmap, 1);
+    return PGSIZE;
+  }
+
+  if(n > PGSIZE - q->off)
+    n = PGSIZE - q->off;
+  if(copyout(p->pagetable, dst, (char*)pa + q->off, n) < 0)
+    return -1;
+  q->off += n;
+  if(q->off == PGSIZE){
+    q->off = 0;
+    q->nread++;
+    kfree((void*)pa);
+  }
+  return n;
+}
+
+// Drop the pages still queued in a pipe being freed.
+void
+flip_drain(struct flipq *q)
+{
+  while(q->nread != q->nwrite)
+    kfree((void*)q->pa[q->nread++ % NFLIP]);
+  q->off = 0;
+}
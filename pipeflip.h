@@ -0,0 +1,9 @@
+// Pages in flight through a pipe by page flipping; see pipeflip.c.
+#define NFLIP 8
+
+struct flipq {
+  uint64 pa[NFLIP];   // queued pages, one reference each
+  uint nread;         // pages taken out
+  uint nwrite;        // pages put in
+  uint off;           // bytes of pa[nread % NFLIP] already read
+};
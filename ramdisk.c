@@ -0,0 +1,62 @@
+// RAM-backed block device.
+//
+// Serves device RAMDISKDEV from pages allocated with kalloc(),
+// PGSIZE/BSIZE blocks to a page.  Pages are allocated on the first
+// write to any of their blocks; blocks never written read as zeros.
+// There is no seek or transfer delay, so buffer cache benchmarks run
+// against it measure bio.c itself rather than the virtio emulation.
+// Contents are lost at reboot.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+
+// size of the device, in blocks
+#define RAMDISK_NBLOCKS 4096
+#define BPP (PGSIZE / BSIZE)   // blocks per page
+
+struct {
+  struct spinlock lock;
+  char *page[RAMDISK_NBLOCKS / BPP];
+} ramdisk;
+
+void
+ramdiskinit(void)
+{
+  initlock(&ramdisk.lock, "ramdisk");
+}
+
+// Copy b's block to or from memory.  b must be locked.
+// Unlike virtio_disk_rw this never sleeps.
+void
+ramdisk_rw(struct buf *b, int write)
+{
+  char *pa;
+
+  if(!holdingsleep(&b->lock))
+    panic("ramdisk_rw: buf not locked");
+  if(b->blockno >= RAMDISK_NBLOCKS)
+    panic("ramdisk_rw: blockno");
+
+  acquire(&ramdisk.lock);
+  pa = ramdisk.page[b->blockno / BPP];
+  if(pa == 0 && write){
+    if((pa = kalloc()) == 0)
+      panic("ramdisk_rw: out of memory");
+    memset(pa, 0, PGSIZE);
+    ramdisk.page[b->blockno / BPP] = pa;
+  }
+  release(&ramdisk.lock);
+
+  if(pa == 0)
+    memset(b->data, 0, BSIZE);
+  else if(write)
+    memmove(pa + (b->blockno % BPP) * BSIZE, b->data, BSIZE);
+  else
+    memmove(b->data, pa + (b->blockno % BPP) * BSIZE, BSIZE);
+}
@@ -0,0 +1,201 @@
+// Shared memory segments.
+//
+// A pipe copies every byte twice, into the kernel's pipe page and
+// out again.  A segment is a set of kalloc'd pages that several
+// processes map at once, so they can exchange data with no system
+// call at all once it is set up (see shmring.c for a ring buffer
+// on top).
+//
+//   shmget(key, npages)  find the segment named key, creating it
+//                        with npages pages if there is none;
+//                        returns its id
+//   shmat(id)            map the segment; returns its address
+//   shmdt(addr)          unmap it
+//
+// The segment holds one reference to each page and every mapping
+// another, so uvmunmap's kfree does the right thing.  A segment
+// goes away when its last mapping does; one that was created but
+// never mapped stays until someone maps and unmaps it.
+//
+// Segments are mapped just below the trapframe, in NSHMPROC fixed
+// windows of SHMMAXPG pages, above anything growproc may reach.
+// Mappings are not inherited: a forked child calls shmat itself.
+//
+// Hooks outside this file:
+// * syscall.c, syscall.h, usys.pl and user.h get the three calls.
+// * growproc refuses to grow the heap past SHMBASE.
+// * freeproc calls shm_exit before freeing the page table, since
+//     uvmfree only frees up to p->sz; exec calls it at its point
+//     of no return, before switching to the new page table.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NSHM      16      // segments in the system
+#define SHMMAXPG  16      // most pages in a segment
+#define NSHMPROC  4       // segments mapped by one process
+#define SHMBASE   (TRAPFRAME - NSHMPROC * SHMMAXPG * PGSIZE)
+
+struct shmseg {
+  int key;
+  int npages;       // 0 if the segment is unused
+  int nattach;
+  char *pa[SHMMAXPG];
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+  // segment index + 1 mapped in each window of each process
+  char att[NPROC][NSHMPROC];
+} shm;
+
+extern struct proc proc[NPROC];
+
+void
+shminit(void)
+{
+  initlock(&shm.lock, "shm");
+}
+
+static uint64
+window(int w)
+{
+  return SHMBASE + (uint64)w * SHMMAXPG * PGSIZE;
+}
+
+// Free the pages of a segment with no mappings left.
+// Caller holds shm.lock.
+static void
+segfree(struct shmseg *s)
+{
+  int i;
+
+  for(i = 0; i < s->npages; i++)
+    kfree(s->pa[i]);
+  s->npages = 0;
+}
+
+// Unmap window w of p.  Caller holds shm.lock.
+static void
+detach(struct proc *p, int w)
+{
+  struct shmseg *s = &shm.seg[shm.att[p - proc][w] - 1];
+
+  uvmunmap(p->pagetable, window(w), s->npages, 1);
+  shm.att[p - proc][w] = 0;
+  if(--s->nattach == 0)
+    segfree(s);
+}
+
+uint64
+sys_shmget(void)
+{
+  struct shmseg *s, *free = 0;
+  int key, npages, i;
+
+  argint(0, &key);
+  argint(1, &npages);
+
+  acquire(&shm.lock);
+  for(s = shm.seg; s < shm.seg + NSHM; s++){
+    if(s->npages && s->key == key){
+      release(&shm.lock);
+      return s - shm.seg;
+    }
+    if(s->npages == 0 && free == 0)
+      free = s;
+  }
+  if(free == 0 || npages < 1 || npages > SHMMAXPG){
+    release(&shm.lock);
+    return -1;
+  }
+  for(i = 0; i < npages; i++){
+    if((free->pa[i] = kalloc()) == 0){
+      while(--i >= 0)
+        kfree(free->pa[i]);
+      release(&shm.lock);
+      return -1;
+    }
+    memset(free->pa[i], 0, PGSIZE);
+  }
+  free->key = key;
+  free->npages = npages;
+  free->nattach = 0;
+  release(&shm.lock);
+  return free - shm.seg;
+}
+
+uint64
+sys_shmat(void)
+{
+  struct proc *p = myproc();
+  struct shmseg *s;
+  int id, w, i;
+
+  argint(0, &id);
+  if(id < 0 || id >= NSHM)
+    return -1;
+
+  acquire(&shm.lock);
+  s = &shm.seg[id];
+  for(w = 0; w < NSHMPROC && shm.att[p - proc][w]; w++)
+    ;
+  if(s->npages == 0 || w == NSHMPROC){
+    release(&shm.lock);
+    return -1;
+  }
+  for(i = 0; i < s->npages; i++){
+    if(mappages(p->pagetable, window(w) + i * PGSIZE, PGSIZE,
+                (uint64)s->pa[i], PTE_R | PTE_W | PTE_U) != 0){
+      uvmunmap(p->pagetable, window(w), i, 1);
+      release(&shm.lock);
+      return -1;
+    }
+    kref(s->pa[i]);
+  }
+  shm.att[p - proc][w] = id + 1;
+  s->nattach++;
+  release(&shm.lock);
+  return window(w);
+}
+
+uint64
+sys_shmdt(void)
+{
+  struct proc *p = myproc();
+  uint64 va;
+  int w;
+
+  argaddr(0, &va);
+  for(w = 0; w < NSHMPROC; w++)
+    if(va == window(w))
+      break;
+
+  acquire(&shm.lock);
+  if(w == NSHMPROC || shm.att[p - proc][w] == 0){
+    release(&shm.lock);
+    return -1;
+  }
+  detach(p, w);
+  release(&shm.lock);
+  return 0;
+}
+
+// Drop all of p's mappings, before its page table is freed.
+void
+shm_exit(struct proc *p)
+{
+  int w;
+
+  acquire(&shm.lock);
+  for(w = 0; w < NSHMPROC; w++)
+    if(shm.att[p - proc][w])
+      detach(p, w);
+  release(&shm.lock);
+}
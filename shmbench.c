@@ -0,0 +1,114 @@
+// Shared memory vs. pipe message throughput.
+//
+// A child produces total bytes in msgsize-byte messages and the
+// parent consumes them, first through a pipe and then through a
+// shmring in a shared memory segment.  Both sides of the ring spin
+// when it is full or empty, so run it with more than one CPU.
+//
+// usage: shmbench [-t total-kbytes] [-m msgsize] [-k key]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "user/shmring.h"
+#include "user/benchlib.h"
+
+#define MAXMSG      4096
+#define SHMPAGES    4
+
+int kbytes = 4096;
+int msgsize = 512;
+int key = 1;
+int total;          // bytes, a whole number of messages
+
+char msg[MAXMSG];
+
+struct benchopt opts[] = {
+  { 't', &kbytes },
+  { 'm', &msgsize },
+  { 'k', &key },
+  { 0 },
+};
+
+// Ticks to move total bytes through a pipe.
+int
+bench_pipe(void)
+{
+  int fds[2], t0, n, got = 0;
+
+  if(pipe(fds) < 0)
+    benchdie("pipe");
+  t0 = uptime();
+  if(fork() == 0){
+    close(fds[0]);
+    for(n = 0; n < total; n += msgsize)
+      if(write(fds[1], msg, msgsize) != msgsize)
+        benchdie("write");
+    exit(0);
+  }
+  close(fds[1]);
+  while(got < total && (n = read(fds[0], msg, msgsize)) > 0)
+    got += n;
+  close(fds[0]);
+  wait(0);
+  if(got != total)
+    benchdie("pipe transfer");
+  return uptime() - t0;
+}
+
+// Ticks to move total bytes through a ring in shared memory.
+int
+bench_shm(void)
+{
+  struct shmring *r;
+  char *va;
+  int id, t0, n, done, got = 0;
+
+  if((id = shmget(key, SHMPAGES)) < 0)
+    benchdie("shmget");
+  if((va = (char*)shmat(id)) == (char*)-1)
+    benchdie("shmat");
+  r = ring_init(va, SHMPAGES * 4096);
+
+  t0 = uptime();
+  if(fork() == 0){
+    if((r = (struct shmring*)shmat(id)) == (struct shmring*)-1)
+      benchdie("shmat");
+    for(n = 0; n < total; n += msgsize)
+      for(done = 0; done < msgsize; )
+        done += ring_write(r, msg + done, msgsize - done);
+    shmdt(r);
+    exit(0);
+  }
+  while(got < total)
+    got += ring_read(r, msg, msgsize);
+  wait(0);
+  t0 = uptime() - t0;
+  shmdt(va);
+  return t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int tpipe, tshm, kpipe, kshm;
+
+  benchinit("shmbench", "[-t total-kbytes] [-m msgsize] [-k key]");
+  benchargs(argc, argv, opts);
+  total = kbytes * 1024;
+  if(msgsize < 1 || msgsize > MAXMSG || total < msgsize)
+    benchusage();
+  total -= total % msgsize;
+
+  tpipe = bench_pipe();
+  tshm = bench_shm();
+  kpipe = benchkbps(total, tpipe);
+  kshm = benchkbps(total, tshm);
+
+  printf("shmbench: %d KB in %d-byte messages\n", total / 1024, msgsize);
+  printf("shmbench: pipe %d ticks, %d KB/s\n", tpipe, kpipe);
+  printf("shmbench: shm  %d ticks, %d KB/s\n", tshm, kshm);
+  printf("BENCH shmbench kbytes=%d msgsize=%d pipe_kbps=%d shm_kbps=%d\n",
+         total / 1024, msgsize, kpipe, kshm);
+  exit(0);
+}
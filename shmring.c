@@ -0,0 +1,68 @@
+// Lock-free ring buffer for shared memory segments; see shmring.h.
+//
+//   int id = shmget(key, npages);
+//   struct shmring *r = ring_init(shmat(id), npages * 4096);
+//
+// ring_init is called once, by the side that creates the segment;
+// the other side just casts the address shmat returns.
+
+#include "kernel/types.h"
+#include "user/user.h"
+#include "user/shmring.h"
+
+// Lay a ring out over bytes bytes of memory at mem.
+struct shmring*
+ring_init(void *mem, uint bytes)
+{
+  struct shmring *r = mem;
+  uint size = 1;
+
+  while(size * 2 <= bytes - sizeof(*r))
+    size *= 2;
+  r->head = 0;
+  r->tail = 0;
+  r->size = size;
+  __sync_synchronize();
+  return r;
+}
+
+// Copy up to n bytes into the ring.  Returns the number copied,
+// 0 if the ring is full.
+int
+ring_write(struct shmring *r, const char *buf, int n)
+{
+  uint head = r->head, off, m;
+
+  if(n > r->size - (head - r->tail))
+    n = r->size - (head - r->tail);
+  off = head & (r->size - 1);
+  m = r->size - off;
+  if(m > n)
+    m = n;
+  memmove(r->data + off, buf, m);
+  memmove(r->data, buf + m, n - m);
+  __sync_synchronize();
+  r->head = head + n;
+  return n;
+}
+
+// Copy up to n bytes out of the ring.  Returns the number copied,
+// 0 if the ring is empty.
+int
+ring_read(struct shmring *r, char *buf, int n)
+{
+  uint tail = r->tail, off, m;
+
+  if(n > r->head - tail)
+    n = r->head - tail;
+  __sync_synchronize();
+  off = tail & (r->size - 1);
+  m = r->size - off;
+  if(m > n)
+    m = n;
+  memmove(buf, r->data + off, m);
+  memmove(buf + m, r->data, n - m);
+  __sync_synchronize();
+  r->tail = tail + n;
+  return n;
+}
@@ -0,0 +1,20 @@
+// Single-producer, single-consumer byte ring in shared memory.
+//
+// One process writes, one reads; neither takes a lock or makes a
+// system call.  Each side owns one index and only reads the
+// other's, and a barrier orders the data copy before the index
+// update that publishes it.  The indices run freely and wrap at
+// 2^32; size is a power of two, so head - tail is the fill level.
+
+struct shmring {
+  volatile uint head;   // bytes written; changed only by the producer
+  char pad0[60];        // keep the indices on separate cache lines
+  volatile uint tail;   // bytes read; changed only by the consumer
+  char pad1[60];
+  uint size;            // capacity of data[], a power of two
+  char data[];
+};
+
+struct shmring* ring_init(void *mem, uint bytes);
+int ring_write(struct shmring *r, const char *buf, int n);
+int ring_read(struct shmring *r, char *buf, int n);
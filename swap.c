@@ -0,0 +1,398 @@
+// Demand paging to a swap area on the block device.
+//
+// When memory runs out, swapout picks victim user pages with a
+// clock sweep over all processes' page tables: a page whose
+// accessed bit (PTE_A) is set gets the bit cleared and a second
+// chance; a page found with the bit still clear is evicted.  An
+// evicted page's PTE loses PTE_V, gets PTE_SWAP, and holds the swap
+// slot number where the physical page number was.  The next access
+// faults, and usertrap calls swapin to read the page back.
+//
+// A victim that compresses well is put in the in-memory store
+// (zram.c) right away and never reaches the disk; its PTE holds the
+// store's slot number with ZSLOT set.  The other victims are
+// collected under each process's lock, then written out in one
+// batch through the buffer cache with boverwrite and bwrite_batch,
+// since the old contents of swap blocks never need to be read.
+// A slot stays SLOT_WRITING until its write is done; a swapin of
+// that slot waits for it.
+//
+// Locking: swap.outlock, then swap.handlock, then p->lock, then
+// swap.lock.  swapfree runs with p->lock held (from freeproc) and
+// so must not sleep.  outlock, a sleeplock, makes swapouts take
+// turns from collecting victims to the end of the write, so at most
+// one batch of NBUF/2 buffers is ever locked for swap and bget
+// always has buffers left for everyone else.
+//
+// The swap area is up to NSWAPSLOT page-sized slots on SWAPDEV
+// starting at block SWAPSTART, just past the file system, so the
+// disk image must be made large enough by mkfs.  main passes
+// swapinit the number of slots mkfs made room for; with 0 there is
+// no swap disk and only the zram store is used.
+//
+// PTE_SWAP and ZSLOT live in cow.h, next to PTE_COW, for the
+// hooks in vm.c and ucopy.c.
+//
+// Hooks outside this file:
+// * usertrap calls swapin on a load/store/instruction page fault.
+// * walkaddr, copyin, copyout and copyinstr in vm.c, like
+//     ucopyout, call swapfault when the PTE they find has PTE_SWAP,
+//     and walk again if it returns 1, so a read() or write() into a
+//     swapped-out buffer works instead of failing.
+// * piperead and pipewrite copy under pi->lock, where swapfault
+//     cannot sleep; when a copy fails they release the lock, call
+//     swapfault on the user page, and retry.
+// * uvmunmap calls swapfree for PTE_SWAP entries instead of
+//     treating them as unmapped.
+// * fork calls swapinall before allocproc, since uvmcopy runs
+//     under np->lock and must not sleep, and swapunpin once uvmcopy
+//     is done or the fork has failed.  In between the parent is
+//     pinned: swapout skips it even while it is preempted, so no
+//     page is evicted again before uvmcopy gets to it.
+// * allocation paths that may sleep and hold no spinlock (uvmalloc)
+//     use kalloc_wait instead of kalloc.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "cow.h"
+
+extern uint64 uvmgen;   // see ucopy.c
+extern uint ticks;
+
+#define SWAPDEV    ROOTDEV
+#define SWAPSTART  FSSIZE
+#define NSWAPSLOT  1024
+#define SLOTBLOCKS (PGSIZE / BSIZE)
+// pages written per swapout; keeps the batch within half the cache
+#define SWAPBATCH  (NBUF / 2 / SLOTBLOCKS)
+
+#define SLOT_FREE    0
+#define SLOT_WRITING 1
+#define SLOT_USED    2
+#define SLOT_DEAD    3    // freed while its write was in progress
+
+struct {
+  struct spinlock lock;       // slot states and counters
+  char slot[NSWAPSLOT];
+  int nslot;          // slots on the disk, 0 if none
+  struct sleeplock outlock;   // one swapout at a time
+  struct spinlock handlock;   // clock hand
+  int hand_proc;      // clock hand: process index
+  uint64 hand_va;     // and virtual address within it
+  char pinned[NPROC]; // swapout skips these; guarded by p->lock
+  uint64 nout;        // pages written to swap
+  uint64 nin;         // pages read back from disk
+  uint64 nzout;       // pages put in the zram store
+  uint64 nzin;        // pages faulted back from zram
+  uint64 inticks;     // time spent in swapin
+} swap;
+
+extern struct proc proc[NPROC];
+
+void
+swapinit(int nslot)
+{
+  if(nslot > NSWAPSLOT)
+    nslot = NSWAPSLOT;
+  swap.nslot = nslot;
+  initlock(&swap.lock, "swap");
+  initlock(&swap.handlock, "swaphand");
+  initsleeplock(&swap.outlock, "swapout");
+}
+
+static int
+slotalloc(void)
+{
+  int i;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    if(swap.slot[i] == SLOT_FREE){
+      swap.slot[i] = SLOT_WRITING;
+      release(&swap.lock);
+      return i;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Write the pages in pa[] to their slots, one burst for all.
+static void
+writeslots(uint64 *pa, int *slot, int n)
+{
+  struct buf *bufs[SWAPBATCH * SLOTBLOCKS];
+  int i, j, k = 0;
+
+  for(i = 0; i < n; i++){
+    for(j = 0; j < SLOTBLOCKS; j++){
+      bufs[k] = boverwrite(SWAPDEV, SWAPSTART + slot[i] * SLOTBLOCKS + j);
+      copywords(bufs[k]->data, (char*)pa[i] + j * BSIZE, BSIZE);
+      k++;
+    }
+  }
+  bwrite_batch(bufs, k);
+  for(i = 0; i < k; i++)
+    brelse(bufs[i]);
+}
+
+// Evict up to n user pages to swap.  Returns the number evicted.
+// May sleep; call without holding spinlocks.
+int
+swapout(int n)
+{
+  uint64 pa[SWAPBATCH];
+  int slot[SWAPBATCH];
+  struct proc *p;
+  pte_t *pte;
+  int nv = 0, nz = 0, steps, s, i, changed;
+
+  if(n > SWAPBATCH)
+    n = SWAPBATCH;
+
+  acquiresleep(&swap.outlock);
+  // two full sweeps at most: the first may only clear PTE_A bits
+  acquire(&swap.handlock);
+  for(steps = 0; steps < 2 * NPROC && nv + nz < n; steps++){
+    p = &proc[swap.hand_proc];
+    acquire(&p->lock);
+    if(p->state != UNUSED && p->state != RUNNING && p->pagetable &&
+       !swap.pinned[p - proc]){
+      changed = 0;
+      for(; swap.hand_va < p->sz && nv + nz < n; swap.hand_va += PGSIZE){
+        pte = walk(p->pagetable, swap.hand_va, 0);
+        if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+          continue;
+        if(*pte & PTE_A){
+          *pte &= ~PTE_A;
+          continue;
+        }
+        // shared pages would need every mapping found
+        if(krefcnt((void*)PTE2PA(*pte)) != 1 || kmerged((void*)PTE2PA(*pte)))
+          continue;
+        if((s = zstore((char*)PTE2PA(*pte))) >= 0){
+          kfree((void*)PTE2PA(*pte));
+          *pte = ((uint64)(s | ZSLOT) << 10) | (PTE_FLAGS(*pte) & ~PTE_V) |
+                 PTE_SWAP;
+          nz++;
+          changed = 1;
+          continue;
+        }
+        if((s = slotalloc()) < 0)
+          break;
+        pa[nv] = PTE2PA(*pte);
+        slot[nv] = s;
+        nv++;
+        *pte = ((uint64)s << 10) | (PTE_FLAGS(*pte) & ~PTE_V) | PTE_SWAP;
+        changed = 1;
+      }
+      // mappings changed behind p's back; see ucopy.c
+      if(changed)
+        __sync_fetch_and_add(&uvmgen, 1);
+    }
+    release(&p->lock);
+    if(nv + nz < n){
+      swap.hand_proc = (swap.hand_proc + 1) % NPROC;
+      swap.hand_va = 0;
+    }
+  }
+  release(&swap.handlock);
+
+  if(nz > 0){
+    acquire(&swap.lock);
+    swap.nzout += nz;
+    release(&swap.lock);
+  }
+  if(nv == 0){
+    releasesleep(&swap.outlock);
+    return nz;
+  }
+  writeslots(pa, slot, nv);
+
+  acquire(&swap.lock);
+  for(i = 0; i < nv; i++){
+    if(swap.slot[slot[i]] == SLOT_DEAD)
+      swap.slot[slot[i]] = SLOT_FREE;
+    else
+      swap.slot[slot[i]] = SLOT_USED;
+    wakeup(&swap.slot[slot[i]]);
+  }
+  swap.nout += nv;
+  release(&swap.lock);
+  releasesleep(&swap.outlock);
+
+  for(i = 0; i < nv; i++)
+    kfree((void*)pa[i]);
+  return nv + nz;
+}
+
+// Like kalloc, but when memory is exhausted drops unmapped text
+// cache pages, then evicts user pages to swap.  May sleep.
+void *
+kalloc_wait(void)
+{
+  void *pa;
+
+  while((pa = kalloc()) == 0){
+    if(textcache_reclaim(SWAPBATCH) == 0 && swapout(SWAPBATCH) == 0)
+      return 0;
+  }
+  // only now, so the reserve never takes the pages swapout
+  // freed for this caller
+  zrefill();
+  return pa;
+}
+
+// If va in the current process was swapped out, read it back.
+// Returns 0 on success, -1 if va is not swapped out or no
+// memory is left.
+int
+swapin(uint64 va)
+{
+  struct proc *p = myproc();
+  struct buf *b;
+  pte_t *pte;
+  char *mem;
+  uint t0 = ticks;
+  int s, j;
+
+  va = PGROUNDDOWN(va);
+  if(va >= MAXVA || (pte = walk(p->pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & PTE_SWAP) == 0)
+    return -1;
+  s = *pte >> 10;
+
+  if(s & ZSLOT){
+    if((mem = kalloc_wait()) == 0)
+      return -1;
+    zload(s & ~ZSLOT, mem);
+    acquire(&p->lock);
+    *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V | PTE_A;
+    release(&p->lock);
+    acquire(&swap.lock);
+    swap.nzin++;
+    swap.inticks += ticks - t0;
+    release(&swap.lock);
+    return 0;
+  }
+
+  acquire(&swap.lock);
+  while(swap.slot[s] == SLOT_WRITING)
+    sleep(&swap.slot[s], &swap.lock);
+  release(&swap.lock);
+
+  if((mem = kalloc_wait()) == 0)
+    return -1;
+  for(j = 0; j < SLOTBLOCKS; j++){
+    b = bread(SWAPDEV, SWAPSTART + s * SLOTBLOCKS + j);
+    copywords(mem + j * BSIZE, b->data, BSIZE);
+    brelse(b);
+  }
+
+  acquire(&p->lock);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V | PTE_A;
+  release(&p->lock);
+
+  acquire(&swap.lock);
+  swap.slot[s] = SLOT_FREE;
+  swap.nin++;
+  swap.inticks += ticks - t0;
+  release(&swap.lock);
+  return 0;
+}
+
+// For kernel copies to and from user memory: if va in pagetable
+// is swapped out, read it back.  Returns 1 if the caller should
+// walk the page table again, or 0 if va is not swapped out or it
+// cannot be swapped in here: the page table is not the current
+// process's, or the caller holds a spinlock and must not sleep.
+int
+swapfault(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  int noff;
+
+  // our own push_off counts one; more means a spinlock is held
+  push_off();
+  noff = mycpu()->noff;
+  pop_off();
+  if(p == 0 || p->pagetable != pagetable || noff > 1)
+    return 0;
+  return swapin(va) == 0;
+}
+
+// Read back every swapped-out page of the current process and
+// keep them all resident until swapunpin, so that fork can copy
+// its address space without sleeping.  Returns 0 on success, or
+// -1, already unpinned, if memory ran out.
+int
+swapinall(void)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint64 va;
+
+  // pin first, so pages read back here stay put
+  acquire(&p->lock);
+  swap.pinned[p - proc] = 1;
+  release(&p->lock);
+  for(va = 0; va < p->sz; va += PGSIZE){
+    pte = walk(p->pagetable, va, 0);
+    if(pte && (*pte & PTE_SWAP) && swapin(va) < 0){
+      swapunpin();
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Let swapout evict the current process's pages again.
+void
+swapunpin(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&p->lock);
+  swap.pinned[p - proc] = 0;
+  release(&p->lock);
+}
+
+// Release the swap slot held by a swapped-out PTE.
+// Does not sleep; a slot still being written is freed by
+// swapout when the write completes.
+void
+swapfree(pte_t *pte)
+{
+  int s = *pte >> 10;
+
+  if(s & ZSLOT){
+    zfree(s & ~ZSLOT);
+    *pte = 0;
+    return;
+  }
+  acquire(&swap.lock);
+  if(swap.slot[s] == SLOT_WRITING)
+    swap.slot[s] = SLOT_DEAD;
+  else
+    swap.slot[s] = SLOT_FREE;
+  release(&swap.lock);
+  *pte = 0;
+}
+
+// zram hit rate is nzin / (nzin + nin); mean fault latency is
+// inticks / (nzin + nin).
+void
+swapstats(void)
+{
+  printf("swap: %d out, %d in; zram: %d out, %d in; %d ticks in swapin\n",
+         (int)swap.nout, (int)swap.nin, (int)swap.nzout, (int)swap.nzin,
+         (int)swap.inticks);
+}
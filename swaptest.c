@@ -0,0 +1,81 @@
+// read() into a swapped-out buffer.
+//
+// The parent fills a buffer and blocks on a pipe while a child
+// allocates memory until sbrk fails, which makes kalloc_wait evict
+// the sleeping parent's pages (swap.c).  The parent then read()s a
+// file into the buffer: copyout must fault each page back in
+// through swapfault rather than fail.
+//
+// usage: swaptest
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define PGSIZE      4096
+#define NPAGE       32
+#define FILE        "swaptest.tmp"
+
+void
+fail(char *what)
+{
+  fprintf(2, "swaptest: %s FAILED\n", what);
+  unlink(FILE);
+  exit(1);
+}
+
+// Take memory until there is none left, then tell the parent.
+void
+hog(int fd)
+{
+  int n;
+
+  for(n = 64 * PGSIZE; n >= PGSIZE; n /= 2)
+    while(sbrk(n) != (char*)-1)
+      ;
+  write(fd, "x", 1);
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *buf, c;
+  int fd, fds[2], i;
+
+  if((buf = sbrk(NPAGE * PGSIZE)) == (char*)-1)
+    fail("sbrk");
+
+  memset(buf, 'b', NPAGE * PGSIZE);
+  if((fd = open(FILE, O_CREATE | O_WRONLY)) < 0)
+    fail("create");
+  if(write(fd, buf, NPAGE * PGSIZE) != NPAGE * PGSIZE)
+    fail("write");
+  close(fd);
+  memset(buf, 'a', NPAGE * PGSIZE);
+
+  if(pipe(fds) < 0)
+    fail("pipe");
+  if(fork() == 0){
+    close(fds[0]);
+    hog(fds[1]);
+  }
+  close(fds[1]);
+  if(read(fds[0], &c, 1) != 1)
+    fail("hog");
+  close(fds[0]);
+  wait(0);
+
+  if((fd = open(FILE, O_RDONLY)) < 0)
+    fail("open");
+  if(read(fd, buf, NPAGE * PGSIZE) != NPAGE * PGSIZE)
+    fail("read into swapped buffer");
+  close(fd);
+  for(i = 0; i < NPAGE * PGSIZE; i++)
+    if(buf[i] != 'b')
+      fail("contents");
+  unlink(FILE);
+  printf("swaptest: OK\n");
+  exit(0);
+}
@@ -0,0 +1,202 @@
+// Page cache for program text.
+//
+// exec used to kalloc a fresh page for every page of every segment
+// and fill it from the file, so fifty shells held fifty copies of
+// the same code.  Pages of read-only segments now come from here
+// instead: textpage returns a page holding bytes [off, off+n) of
+// the inode, zero-filled past n, with a reference added for the
+// caller.  The cache keeps a reference of its own, so the page
+// outlives the process and the next exec of the binary maps it
+// without reading the file again.
+//
+// The table is direct-mapped on (dev, inum, off, n), like
+// bmcache.c; a new page replaces the old one in its slot, and
+// dropping the cache's reference frees the old page once no
+// process maps it any more.  n is part of the key because the
+// tail of a segment's last page must read as zeros, not as the
+// file bytes that follow.
+//
+// Hooks outside this file:
+// * loadseg, for a segment without ELF_PROG_FLAG_WRITE, maps each
+//     page from textpage read-only (PTE_R|PTE_X|PTE_U, never PTE_W)
+//     instead of copying into pages from uvmalloc.  uvmunmap's
+//     kfree drops the mapping's reference as usual.
+// * writei and itrunc call textcache_inval, so a rewritten or
+//     deleted binary is read afresh by the next exec.  Processes
+//     already running it keep the pages they have mapped.
+// * struct inode gains a char hastext, set by textpage, so that
+//     textcache_inval returns at once for the ordinary files that
+//     writei writes, without taking textcache.lock.  ilock sets
+//     it when it reads the inode from disk, since pages cached
+//     under an earlier in-memory copy may still be here; the first
+//     write after that scans once and clears it.
+// Shared pages have a count above 1, so swapout, kmigrate and
+// ksmscan leave them alone.  Instead kalloc_wait (swap.c) calls
+// textcache_reclaim before it swaps anything out, which drops the
+// cached pages no process maps any more; they cost only a read
+// at the next exec.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+
+#define NTEXT 128
+
+struct tentry {
+  uint dev;
+  uint inum;    // 0 if the slot is empty
+  uint off;     // file offset of the page
+  uint n;       // bytes from the file; the rest is zero
+  char *pa;
+};
+
+struct {
+  struct spinlock lock;
+  struct tentry e[NTEXT];
+  uint64 hits;      // pages mapped without a kalloc or a read
+  uint64 misses;
+  uint64 reclaimed; // pages dropped for kalloc_wait
+} textcache;
+
+void
+textcacheinit(void)
+{
+  initlock(&textcache.lock, "textcache");
+}
+
+static struct tentry*
+slot(uint dev, uint inum, uint off)
+{
+  return &textcache.e[(dev * 31 + inum * 131 + off / PGSIZE) % NTEXT];
+}
+
+static int
+match(struct tentry *e, uint dev, uint inum, uint off, uint n)
+{
+  return e->inum == inum && e->dev == dev && e->off == off && e->n == n;
+}
+
+// Return a page with bytes [off, off+n) of ip, n <= PGSIZE, with a
+// reference for the caller, or 0 if out of memory or the read fails.
+// Caller holds ip->lock, which also guards ip->hastext.
+char*
+textpage(struct inode *ip, uint off, uint n)
+{
+  struct tentry *e;
+  char *mem, *old = 0;
+
+  ip->hastext = 1;
+  acquire(&textcache.lock);
+  e = slot(ip->dev, ip->inum, off);
+  if(match(e, ip->dev, ip->inum, off, n)){
+    mem = e->pa;
+    kref(mem);
+    textcache.hits++;
+    release(&textcache.lock);
+    return mem;
+  }
+  textcache.misses++;
+  release(&textcache.lock);
+
+  // readi may sleep, so fill the page outside the lock
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  if(readi(ip, 0, (uint64)mem, off, n) != n){
+    kfree(mem);
+    return 0;
+  }
+
+  acquire(&textcache.lock);
+  if(match(e, ip->dev, ip->inum, off, n)){
+    // another exec filled the slot meanwhile; use its page
+    old = mem;
+    mem = e->pa;
+  } else {
+    if(e->inum)
+      old = e->pa;
+    e->dev = ip->dev;
+    e->inum = ip->inum;
+    e->off = off;
+    e->n = n;
+    e->pa = mem;
+  }
+  kref(mem);
+  release(&textcache.lock);
+  if(old)
+    kfree(old);
+  return mem;
+}
+
+// Drop every cached page of inode ip.  Caller holds ip->lock.
+void
+textcache_inval(struct inode *ip)
+{
+  struct tentry *e;
+  char *drop[NTEXT];
+  int i, n = 0;
+
+  if(!ip->hastext)
+    return;
+  ip->hastext = 0;
+  acquire(&textcache.lock);
+  for(e = textcache.e; e < textcache.e + NTEXT; e++){
+    if(e->inum == ip->inum && e->dev == ip->dev){
+      e->inum = 0;
+      drop[n++] = e->pa;
+    }
+  }
+  release(&textcache.lock);
+  for(i = 0; i < n; i++)
+    kfree(drop[i]);
+}
+
+// Drop up to n cached pages that only the cache refers to.
+// Returns the number freed.
+int
+textcache_reclaim(int n)
+{
+  struct tentry *e;
+  char *drop[NTEXT];
+  int i, k = 0;
+
+  acquire(&textcache.lock);
+  for(e = textcache.e; e < textcache.e + NTEXT && k < n; e++){
+    if(e->inum && krefcnt(e->pa) == 1){
+      e->inum = 0;
+      drop[k++] = e->pa;
+    }
+  }
+  textcache.reclaimed += k;
+  release(&textcache.lock);
+  for(i = 0; i < k; i++)
+    kfree(drop[i]);
+  return k;
+}
+
+// Pages held in the cache, and how many extra mappings of them
+// exist; each of those is a page exec did not have to allocate.
+void
+textcachestats(void)
+{
+  struct tentry *e;
+  int npages = 0, shared = 0;
+
+  acquire(&textcache.lock);
+  for(e = textcache.e; e < textcache.e + NTEXT; e++){
+    if(e->inum){
+      npages++;
+      if(krefcnt(e->pa) > 2)
+        shared += krefcnt(e->pa) - 2;
+    }
+  }
+  printf("textcache: %d hits, %d misses, %d pages cached, %d mappings saved, "
+         "%d reclaimed\n", (int)textcache.hits, (int)textcache.misses,
+         npages, shared, (int)textcache.reclaimed);
+  release(&textcache.lock);
+}
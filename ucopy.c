@@ -0,0 +1,81 @@
+// Bulk copies from kernel buffers to user space.
+//
+// copyout walks the page table for every page-sized chunk of every
+// call.  A read() that hits the buffer cache calls it once per
+// block, so with BSIZE < PGSIZE the same user page is looked up
+// several times in a row.  A ucursor remembers the last user page
+// translated, so consecutive calls that land on the same page skip
+// the walk.  readi would set one up per read:
+//
+//   struct ucursor uc;
+//   ucursor_init(&uc, myproc()->pagetable);
+//   ... for each block: ucopyout(&uc, dst, bp->data + off, m) ...
+//
+// A cursor is only valid for the duration of one system call.
+// The caller may sleep between copies, and kcompact or ksmscan may
+// move or write-protect the user page meanwhile; they bump uvmgen
+// before p can run again, and the cursor then translates again.
+// Copy-on-write pages are made private before being written, and
+// swapped-out pages are read back in.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "ucopy.h"
+#include "cow.h"
+
+// generation of user mappings changed behind their process's
+// back, by kcompact, ksmscan or swapout
+uint64 uvmgen;
+
+void
+ucursor_init(struct ucursor *uc, pagetable_t pagetable)
+{
+  uc->pagetable = pagetable;
+  uc->va0 = -1;
+  uc->pa0 = 0;
+  uc->gen = uvmgen;
+}
+
+// Copy len bytes from src to virtual address dstva in the
+// cursor's page table.  A whole, aligned page goes straight
+// to the user page in one copy.  Return 0 on success, -1 on error.
+int
+ucopyout(struct ucursor *uc, uint64 dstva, char *src, uint64 len)
+{
+  uint64 n, va0;
+  pte_t *pte;
+
+  while(len > 0){
+    va0 = PGROUNDDOWN(dstva);
+    if(uc->gen != uvmgen){
+      uc->gen = uvmgen;
+      uc->va0 = -1;
+    }
+    if(va0 != uc->va0){
+      uc->va0 = -1;
+      if(va0 >= MAXVA || (pte = walk(uc->pagetable, va0, 0)) == 0)
+        return -1;
+      if((*pte & PTE_SWAP) && swapfault(uc->pagetable, va0) == 0)
+        return -1;
+      if((*pte & PTE_COW) && cowfault(uc->pagetable, va0) < 0)
+        return -1;
+      // read-only pages may be shared with other processes
+      if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_W) == 0)
+        return -1;
+      uc->pa0 = PTE2PA(*pte);
+      uc->va0 = va0;
+    }
+    n = PGSIZE - (dstva - va0);
+    if(n > len)
+      n = len;
+    copywords((char*)(uc->pa0 + (dstva - va0)), src, n);
+
+    len -= n;
+    src += n;
+    dstva = va0 + PGSIZE;
+  }
+  return 0;
+}
@@ -0,0 +1,7 @@
+// Cursor for a run of copies into one process's address space.
+struct ucursor {
+  pagetable_t pagetable;
+  uint64 va0;   // user page last translated, or -1
+  uint64 pa0;   // its physical address
+  uint64 gen;   // uvmgen when pa0 was looked up
+};
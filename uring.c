@@ -0,0 +1,148 @@
+// Batched system calls through shared rings.
+//
+// Every read or write costs a trap.  A process that calls
+// uring_setup gets one page, shared with the kernel, holding a
+// submission ring and a completion ring (uring.h).  It queues any
+// number of read, write and open requests in the submission ring
+// with plain stores, then one uring_enter runs them all and posts
+// a completion for each, carrying the request's user_data.
+//
+//   uring_setup()   map the rings; returns their address
+//   uring_enter()   run queued requests; returns how many
+//
+// xv6 has no kernel threads, so there is no worker running the
+// requests in the background: uring_enter runs them in the
+// caller's context, through the same fileread, filewrite and open
+// paths as the system calls.  The interface is batched, not
+// asynchronous.  What the process gains is one trap per batch, and,
+// with user-level threads, one trap for the I/O of many threads
+// (see uthread.c).  No I/O overlaps with the process's own
+// computation; uringbench's -w runs measure exactly that.
+//
+// The ring page belongs to the process, which may scribble on it
+// at any time, so each request is copied out of the ring before it
+// is checked, and the indices are read once per call.
+//
+// Hooks outside this file:
+// * syscall.c, syscall.h, usys.pl and user.h get the two calls.
+// * growproc's heap limit moves down from SHMBASE to URINGVA.
+// * freeproc and exec call uring_exit next to shm_exit.
+// * sys_open's body becomes fileopen(path, omode), which returns
+//     the new fd, so UR_OPEN can share it.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+#include "uring.h"
+
+// one page below shm.c's windows, which take the 64 pages
+// under the trapframe
+#define URINGVA (TRAPFRAME - 65 * PGSIZE)
+
+extern struct proc proc[NPROC];
+
+// each process's ring; only the process itself and freeproc,
+// after it is gone, touch its entry, so no lock is needed.  The
+// kernel holds a page reference of its own besides the mapping's,
+// so the page stays put while the kernel writes to it: pipeflip.c,
+// kmigrate and swapout all leave shared pages alone.
+struct uring *uring[NPROC];
+
+uint64 nuenter;     // uring_enter calls
+uint64 nusqe;       // requests run through them
+
+uint64
+sys_uring_setup(void)
+{
+  struct proc *p = myproc();
+  char *mem;
+
+  if(uring[p - proc])
+    return URINGVA;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(p->pagetable, URINGVA, PGSIZE, (uint64)mem,
+              PTE_R | PTE_W | PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  kref(mem);
+  uring[p - proc] = (struct uring*)mem;
+  return URINGVA;
+}
+
+// Run one request; returns what its system call would.
+static int
+urun(struct sqe *e)
+{
+  struct proc *p = myproc();
+  char path[MAXPATH];
+  struct file *f = 0;
+
+  if(e->op == UR_OPEN){
+    if(copyinstr(p->pagetable, path, e->addr, MAXPATH) < 0)
+      return -1;
+    return fileopen(path, e->n);
+  }
+  if(e->fd >= 0 && e->fd < NOFILE)
+    f = p->ofile[e->fd];
+  if(f == 0 || e->n < 0)
+    return -1;
+  if(e->op == UR_READ)
+    return fileread(f, e->addr, e->n);
+  if(e->op == UR_WRITE)
+    return filewrite(f, e->addr, e->n);
+  return -1;
+}
+
+uint64
+sys_uring_enter(void)
+{
+  struct uring *r = uring[myproc() - proc];
+  struct sqe e;
+  struct cqe c;
+  uint head, tail, ctail;
+  int n = 0;
+
+  if(r == 0)
+    return -1;
+  head = r->sq_head;
+  tail = r->sq_tail;
+  ctail = r->cq_tail;
+  __sync_synchronize();
+  if(tail - head > NSQE)
+    return -1;
+
+  // stop when the completion ring is full; the rest stays queued
+  for(; head != tail && ctail - r->cq_head < NCQE; head++, n++){
+    e = r->sq[head & (NSQE - 1)];
+    c.user_data = e.user_data;
+    c.res = urun(&e);
+    r->cq[ctail & (NCQE - 1)] = c;
+    __sync_synchronize();
+    r->cq_tail = ++ctail;
+    r->sq_head = head + 1;
+  }
+  __sync_fetch_and_add(&nuenter, 1);
+  __sync_fetch_and_add(&nusqe, n);
+  return n;
+}
+
+// Unmap p's rings, before its page table is freed.
+void
+uring_exit(struct proc *p)
+{
+  if(uring[p - proc] == 0)
+    return;
+  uvmunmap(p->pagetable, URINGVA, 1, 1);
+  kfree(uring[p - proc]);
+  uring[p - proc] = 0;
+}
@@ -0,0 +1,34 @@
+// Submission and completion rings shared between a process and
+// the kernel; see uring.c.  One page, mapped at the address that
+// uring_setup returns.
+
+#define UR_READ   1   // read(fd, addr, n)
+#define UR_WRITE  2   // write(fd, addr, n)
+#define UR_OPEN   3   // open(addr, n); res is the new fd
+
+#define NSQE      32  // power of two
+#define NCQE      64  // power of two, room for two rounds of SQEs
+
+struct sqe {
+  int op;
+  int fd;
+  uint64 addr;
+  int n;
+  uint64 user_data;   // handed back in the completion
+};
+
+struct cqe {
+  uint64 user_data;
+  int res;            // what the system call would have returned
+};
+
+// The process moves sq_tail and cq_head, the kernel sq_head and
+// cq_tail.  Indices run freely; mask them with NSQE-1 or NCQE-1.
+struct uring {
+  volatile uint sq_head;
+  volatile uint sq_tail;
+  volatile uint cq_head;
+  volatile uint cq_tail;
+  struct sqe sq[NSQE];
+  struct cqe cq[NCQE];
+};
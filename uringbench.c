@@ -0,0 +1,216 @@
+// System calls one at a time vs. batched through uring rings.
+//
+// Reads nfiles files round-robin, IOSIZE bytes per request, first
+// with one read() per request and then with one uring_enter() per
+// round of requests (one per file, up to NSQE at a time).  Both go
+// through the same buffer-cache path; the difference is the traps.
+//
+// Then it does both again with -w units of computation per request,
+// done while the requests are queued, before uring_enter.  A kernel
+// that ran queued requests in the background would hide the I/O
+// behind that work, and uring_work_ticks would approach the larger
+// of work_ticks and uring_ticks.  uring_enter runs the requests
+// itself (see uring.c), so nothing overlaps: expect the sum.
+//
+// usage: uringbench [-f nfiles] [-n requests] [-w work]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/uring.h"
+#include "user/user.h"
+#include "user/benchlib.h"
+
+#define MAXFILES    NSQE
+#define IOSIZE      512
+#define FSIZE       (16*1024)
+
+int nfiles = 8;
+int nreq = 4000;
+int nwork = 2000;
+
+char buf[MAXFILES][IOSIZE];
+int fd[MAXFILES];
+
+struct benchopt opts[] = {
+  { 'f', &nfiles },
+  { 'n', &nreq },
+  { 'w', &nwork },
+  { 0 },
+};
+
+volatile int sink;
+
+// Computation standing in for what a program does with its data.
+void
+work(int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    sink += i;
+}
+
+// Ticks for nreq units of work alone.
+int
+bench_work(void)
+{
+  int t0, n;
+
+  t0 = uptime();
+  for(n = 0; n < nreq; n++)
+    work(nwork);
+  return uptime() - t0;
+}
+
+void
+name(char *s, int i)
+{
+  s[0] = 'u';
+  s[1] = 'r';
+  s[2] = '0' + i / 10;
+  s[3] = '0' + i % 10;
+  s[4] = 0;
+}
+
+void
+openall(void)
+{
+  char s[8];
+  int i;
+
+  for(i = 0; i < nfiles; i++){
+    name(s, i);
+    if((fd[i] = open(s, O_RDONLY)) < 0)
+      benchdie("open");
+  }
+}
+
+void
+closeall(void)
+{
+  int i;
+
+  for(i = 0; i < nfiles; i++)
+    close(fd[i]);
+}
+
+// Start file i over once it has been read to the end.
+void
+rewind(int i)
+{
+  char s[8];
+
+  close(fd[i]);
+  name(s, i);
+  if((fd[i] = open(s, O_RDONLY)) < 0)
+    benchdie("open");
+}
+
+// Ticks for nreq read()s, with w units of work after each.
+int
+bench_syscall(int w)
+{
+  int t0, n, i;
+
+  openall();
+  t0 = uptime();
+  for(n = 0; n < nreq; n++){
+    i = n % nfiles;
+    if(read(fd[i], buf[i], IOSIZE) != IOSIZE)
+      rewind(i);
+    work(w);
+  }
+  t0 = uptime() - t0;
+  closeall();
+  return t0;
+}
+
+// Ticks for nreq reads through r, one uring_enter per round,
+// with w units of work per request while the round is queued.
+int
+bench_uring(struct uring *r, int w, int *nenter)
+{
+  struct sqe *e;
+  struct cqe *c;
+  int t0, n, i;
+
+  openall();
+  t0 = uptime();
+  for(n = 0; n < nreq; ){
+    for(i = 0; i < nfiles && n < nreq; i++, n++){
+      e = &r->sq[r->sq_tail & (NSQE - 1)];
+      e->op = UR_READ;
+      e->fd = fd[i];
+      e->addr = (uint64)buf[i];
+      e->n = IOSIZE;
+      e->user_data = i;
+      __sync_synchronize();
+      r->sq_tail++;
+    }
+    work(w * i);
+    if(uring_enter() < 0)
+      benchdie("uring_enter");
+    (*nenter)++;
+    while(r->cq_head != r->cq_tail){
+      c = &r->cq[r->cq_head & (NCQE - 1)];
+      if(c->res != IOSIZE)
+        rewind(c->user_data);
+      r->cq_head++;
+    }
+  }
+  t0 = uptime() - t0;
+  closeall();
+  return t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct uring *r;
+  char s[8];
+  int i, f, tsys, tring, twork, tsysw, tringw, nenter = 0, nenterw = 0;
+
+  benchinit("uringbench", "[-f nfiles] [-n requests] [-w work]");
+  benchargs(argc, argv, opts);
+  if(nfiles < 1 || nfiles > MAXFILES || nreq < 1 || nwork < 0)
+    benchusage();
+
+  memset(buf, 'u', sizeof(buf));
+  for(i = 0; i < nfiles; i++){
+    name(s, i);
+    if((f = open(s, O_CREATE | O_WRONLY)) < 0)
+      benchdie("create");
+    for(int j = 0; j < FSIZE; j += IOSIZE)
+      write(f, buf[0], IOSIZE);
+    close(f);
+  }
+  if((r = uring_setup()) == (struct uring*)-1)
+    benchdie("uring_setup");
+
+  tsys = bench_syscall(0);
+  tring = bench_uring(r, 0, &nenter);
+  twork = bench_work();
+  tsysw = bench_syscall(nwork);
+  tringw = bench_uring(r, nwork, &nenterw);
+
+  for(i = 0; i < nfiles; i++){
+    name(s, i);
+    unlink(s);
+  }
+
+  printf("uringbench: %d reads of %d bytes over %d files\n",
+         nreq, IOSIZE, nfiles);
+  printf("uringbench: read()  %d ticks, %d reads/sec, %d traps\n",
+         tsys, benchpersec(nreq, tsys), nreq);
+  printf("uringbench: uring   %d ticks, %d reads/sec, %d traps\n",
+         tring, benchpersec(nreq, tring), nenter);
+  printf("uringbench: with %d work per read: work alone %d ticks, "
+         "read() %d ticks, uring %d ticks\n", nwork, twork, tsysw, tringw);
+  printf("BENCH uringbench nfiles=%d reqs=%d syscall_ops_per_sec=%d "
+         "uring_ops_per_sec=%d uring_traps=%d uring_ticks=%d work=%d "
+         "work_ticks=%d syscall_work_ticks=%d uring_work_ticks=%d\n",
+         nfiles, nreq, benchpersec(nreq, tsys), benchpersec(nreq, tring),
+         nenter, tring, nwork, twork, tsysw, tringw);
+  exit(0);
+}
@@ -1,11 +1,13 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
+#include "kernel/uring.h"
 
 /* Possible states of a thread: */
 #define FREE        0x0
 #define RUNNING     0x1
 #define RUNNABLE    0x2
+#define WAITING     0x3   /* parked until its I/O request completes */
 
 #define STACK_SIZE  8192 // 2^13
 #define MAX_THREAD  4
@@ -32,12 +34,14 @@ struct context {
 struct thread {
   struct context context;
   char       stack[STACK_SIZE]; /* the thread's stack */
-  int        state;             /* FREE, RUNNING, RUNNABLE */
+  int        state;             /* FREE, RUNNING, RUNNABLE, WAITING */
+  int        ioresult;          /* result of the last thread_io() */
 };
 
 struct thread all_thread[MAX_THREAD];
 struct thread *current_thread;
 extern void thread_switch(uint64, uint64);
+struct uring *ring;               /* set up by the first thread_io() */
               
 void 
 thread_init(void)
@@ -51,25 +55,50 @@ thread_init(void)
   current_thread->state = RUNNING;
 }
 
+/* Run the queued I/O requests in one system call and make the
+ * threads whose requests completed runnable.  Returns how many. */
+int
+thread_reap(void)
+{
+  struct cqe *c;
+  int n = 0;
+
+  if(ring == 0)
+    return 0;
+  uring_enter();
+  while(ring->cq_head != ring->cq_tail){
+    c = &ring->cq[ring->cq_head & (NCQE - 1)];
+    all_thread[c->user_data].ioresult = c->res;
+    all_thread[c->user_data].state = RUNNABLE;
+    __sync_synchronize();
+    ring->cq_head++;
+    n++;
+  }
+  return n;
+}
+
 void 
 thread_schedule(void)
 {
   struct thread *t, *next_thread;
 
-  /* Find another runnable thread. */
-  next_thread = 0;
-  t = current_thread + 1;
-
-  for(int i = 0; i < MAX_THREAD; i++){
-    if(t >= all_thread + MAX_THREAD){
-      t = all_thread;
-    }
-    if(t->state == RUNNABLE) {
-      next_thread = t;
-      break;
+  /* Find another runnable thread; when every thread is waiting
+   * for I/O, submit their requests as one batch. */
+  do {
+    next_thread = 0;
+    t = current_thread + 1;
+
+    for(int i = 0; i < MAX_THREAD; i++){
+      if(t >= all_thread + MAX_THREAD){
+        t = all_thread;
+      }
+      if(t->state == RUNNABLE) {
+        next_thread = t;
+        break;
+      }
+      t = t + 1;
     }
-    t = t + 1;
-  }
+  } while(next_thread == 0 && thread_reap() > 0);
 
   if (next_thread == 0) {
     printf("thread_schedule: no runnable threads\n");
@@ -85,8 +114,10 @@ thread_schedule(void)
      * thread_switch(??, ??);
      */
     thread_switch((uint64)&(t->context), (uint64)&(current_thread->context));
-  } else
+  } else {
+    current_thread->state = RUNNING;
     next_thread = 0;
+  }
 }
 
 void 
@@ -111,6 +142,37 @@ thread_yield(void)
   thread_schedule();
 }
 
+/* Queue a read, write or open (UR_*, see kernel/uring.h) and park
+ * the calling thread until it completes, letting the others run
+ * meanwhile.  The request itself runs only once every thread is
+ * parked, in thread_reap's uring_enter, so the threads share traps
+ * but their I/O does not overlap their computation.  Returns what
+ * the system call would have. */
+int
+thread_io(int op, int fd, void *addr, int n)
+{
+  struct sqe *e;
+
+  if(ring == 0 && (ring = uring_setup()) == (struct uring*)-1){
+    ring = 0;
+    return -1;
+  }
+  if(ring->sq_tail - ring->sq_head == NSQE)
+    thread_reap();
+  e = &ring->sq[ring->sq_tail & (NSQE - 1)];
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint64)addr;
+  e->n = n;
+  e->user_data = current_thread - all_thread;
+  __sync_synchronize();
+  ring->sq_tail++;
+
+  current_thread->state = WAITING;
+  thread_schedule();
+  return current_thread->ioresult;
+}
+
 volatile int a_started, b_started, c_started;
 volatile int a_n, b_n, c_n;
 
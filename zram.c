@@ -0,0 +1,275 @@
+// Compressed in-memory store for swapped-out user pages.
+//
+// swapout offers each victim page to zstore before writing it to
+// the swap disk.  The page is compressed a 64-bit word at a time:
+// runs of one repeated word (zero-filled memory above all) become a
+// count and the word, everything else is copied as literals.  Pages
+// that do not shrink below ZMAXSIZE go to disk instead.
+//
+// Compressed pages live in pool pages from kalloc, each cut into
+// ZCHUNK-byte chunks; an object takes a run of chunks in one pool
+// page.  A pool page is freed when its last object goes.
+//
+// swapout only runs once kalloc has failed, so a new pool page
+// cannot come from kalloc when it is needed.  The store keeps
+// ZSPARE pages in reserve instead, taken at boot and topped up by
+// zrefill once kalloc_wait's caller has the page it asked for, so
+// the reserve never competes with it for the pages swapout freed.
+// Every page stored frees a whole page for at most 3/4 of one, so
+// the reserve keeps up and the store works even with no swap disk
+// at all.
+//
+// zstore runs with the victim process's lock held, so nothing here
+// sleeps.  Locking: p->lock, then zram.lock.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NZSLOT   2048
+#define NZPOOL   256                  // most pool pages
+#define ZSPARE   4                    // pool pages kept in reserve
+#define ZCHUNK   256
+#define ZNCHUNK  (PGSIZE / ZCHUNK)    // chunks per pool page
+#define ZMAXSIZE (PGSIZE * 3 / 4)
+#define NWORDS   (PGSIZE / sizeof(uint64))
+
+#define ZRUN     0x8000   // record header flag: run of one word
+
+struct zslot {
+  short pool;       // pool page index, -1 if the slot is free
+  uchar chunk;      // first chunk
+  uchar nchunk;
+};
+
+struct {
+  struct spinlock lock;
+  char *pool[NZPOOL];
+  ushort used[NZPOOL];        // bit per chunk in use
+  struct zslot slot[NZSLOT];
+  char *spare[ZSPARE];        // reserve pool pages, 0 if used
+  uint64 nstored;             // pages compressed into the store
+  uint64 nrejected;           // pages that did not compress enough
+  uint64 bytes_in;            // page bytes stored
+  uint64 bytes_out;           // compressed bytes stored
+} zram;
+
+// scratch output for compression; guarded by zram.lock
+char zbuf[ZMAXSIZE];
+
+void
+zraminit(void)
+{
+  int i;
+
+  initlock(&zram.lock, "zram");
+  for(i = 0; i < NZSLOT; i++)
+    zram.slot[i].pool = -1;
+  zrefill();
+}
+
+// Top the reserve of pool pages back up.
+void
+zrefill(void)
+{
+  char *mem;
+  int i;
+
+  for(i = 0; i < ZSPARE; i++){
+    if(zram.spare[i])
+      continue;
+    if((mem = kalloc()) == 0)
+      return;
+    acquire(&zram.lock);
+    if(zram.spare[i] == 0){
+      zram.spare[i] = mem;
+      mem = 0;
+    }
+    release(&zram.lock);
+    if(mem)
+      kfree(mem);
+  }
+}
+
+// A page for a new pool page: from kalloc if it has one, else
+// from the reserve.  Caller holds zram.lock.
+static char*
+poolpage(void)
+{
+  char *mem;
+  int i;
+
+  if((mem = kalloc()) != 0)
+    return mem;
+  for(i = 0; i < ZSPARE; i++){
+    if((mem = zram.spare[i]) != 0){
+      zram.spare[i] = 0;
+      return mem;
+    }
+  }
+  return 0;
+}
+
+// Compress the page at src into dst.  Returns the compressed size,
+// or -1 as soon as it exceeds max.
+static int
+zcompress(uint64 *src, char *dst, int max)
+{
+  int i = 0, j, n = 0;
+  ushort hdr;
+
+  while(i < NWORDS){
+    for(j = i + 1; j < NWORDS && src[j] == src[i]; j++)
+      ;
+    if(j - i >= 2){
+      hdr = ZRUN | (j - i);
+      if(n + sizeof(hdr) + sizeof(uint64) > max)
+        return -1;
+      memmove(dst + n, &hdr, sizeof(hdr));
+      memmove(dst + n + sizeof(hdr), &src[i], sizeof(uint64));
+      n += sizeof(hdr) + sizeof(uint64);
+      i = j;
+      continue;
+    }
+    // literals up to the start of the next run
+    for(j = i + 1; j < NWORDS && !(j + 1 < NWORDS && src[j] == src[j+1]); j++)
+      ;
+    hdr = j - i;
+    if(n + sizeof(hdr) + hdr * sizeof(uint64) > max)
+      return -1;
+    memmove(dst + n, &hdr, sizeof(hdr));
+    memmove(dst + n + sizeof(hdr), &src[i], hdr * sizeof(uint64));
+    n += sizeof(hdr) + hdr * sizeof(uint64);
+    i = j;
+  }
+  return n;
+}
+
+static void
+zdecompress(char *src, uint64 *dst)
+{
+  int i = 0, k, cnt;
+  ushort hdr;
+  uint64 v;
+
+  while(i < NWORDS){
+    memmove(&hdr, src, sizeof(hdr));
+    src += sizeof(hdr);
+    cnt = hdr & ~ZRUN;
+    if(hdr & ZRUN){
+      memmove(&v, src, sizeof(v));
+      src += sizeof(v);
+      for(k = 0; k < cnt; k++)
+        dst[i++] = v;
+    } else {
+      memmove(&dst[i], src, cnt * sizeof(uint64));
+      src += cnt * sizeof(uint64);
+      i += cnt;
+    }
+  }
+}
+
+// Find nchunk free chunks in a row in some pool page, adding a
+// pool page if none has room.  Caller holds zram.lock.
+static int
+chunkalloc(int nchunk, int *chunk)
+{
+  ushort mask = (1 << nchunk) - 1;
+  int p, c, empty = -1;
+
+  for(p = 0; p < NZPOOL; p++){
+    if(zram.pool[p] == 0){
+      if(empty < 0)
+        empty = p;
+      continue;
+    }
+    for(c = 0; c + nchunk <= ZNCHUNK; c++){
+      if((zram.used[p] & (mask << c)) == 0){
+        zram.used[p] |= mask << c;
+        *chunk = c;
+        return p;
+      }
+    }
+  }
+  if(empty < 0 || (zram.pool[empty] = poolpage()) == 0)
+    return -1;
+  zram.used[empty] = mask;
+  *chunk = 0;
+  return empty;
+}
+
+// Compress and store the page at pa.  Returns a slot number,
+// or -1 if the page does not compress well or the store is full.
+int
+zstore(char *pa)
+{
+  int n, s, p, c, nchunk;
+
+  acquire(&zram.lock);
+  for(s = 0; s < NZSLOT && zram.slot[s].pool >= 0; s++)
+    ;
+  if(s == NZSLOT){
+    release(&zram.lock);
+    return -1;
+  }
+  if((n = zcompress((uint64*)pa, zbuf, ZMAXSIZE)) < 0){
+    zram.nrejected++;
+    release(&zram.lock);
+    return -1;
+  }
+  nchunk = (n + ZCHUNK - 1) / ZCHUNK;
+  if((p = chunkalloc(nchunk, &c)) < 0){
+    release(&zram.lock);
+    return -1;
+  }
+  memmove(zram.pool[p] + c * ZCHUNK, zbuf, n);
+  zram.slot[s].pool = p;
+  zram.slot[s].chunk = c;
+  zram.slot[s].nchunk = nchunk;
+  zram.nstored++;
+  zram.bytes_in += PGSIZE;
+  zram.bytes_out += n;
+  release(&zram.lock);
+  return s;
+}
+
+// Drop slot s, returning its pool page if that empties it.
+void
+zfree(int s)
+{
+  struct zslot *z = &zram.slot[s];
+  char *page = 0;
+
+  acquire(&zram.lock);
+  zram.used[z->pool] &= ~(((1 << z->nchunk) - 1) << z->chunk);
+  if(zram.used[z->pool] == 0){
+    page = zram.pool[z->pool];
+    zram.pool[z->pool] = 0;
+  }
+  z->pool = -1;
+  release(&zram.lock);
+  if(page)
+    kfree(page);
+}
+
+// Decompress slot s into the page at pa and free the slot.
+void
+zload(int s, char *pa)
+{
+  struct zslot *z = &zram.slot[s];
+
+  acquire(&zram.lock);
+  zdecompress(zram.pool[z->pool] + z->chunk * ZCHUNK, (uint64*)pa);
+  release(&zram.lock);
+  zfree(s);
+}
+
+void
+zramstats(void)
+{
+  printf("zram: %d pages stored, %d rejected, %d bytes -> %d bytes\n",
+         (int)zram.nstored, (int)zram.nrejected,
+         (int)zram.bytes_in, (int)zram.bytes_out);
+}